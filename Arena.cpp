@@ -0,0 +1,81 @@
+#include "Arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation is aligned for any of the file structs
+#define ARENA_ALIGN  16
+#define ARENA_HEADER ((sizeof(Arena::Block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+Arena* Arena::New(size_t blockSize) {
+    Arena* arena = new Arena;
+    if (!arena) {
+        return NULL;
+    }
+
+    arena->BlockSize = blockSize;
+    arena->First = arena->NewBlock(blockSize);
+    if (!arena->First)
+        goto FREE;
+
+    arena->Current = arena->First;
+    return arena;
+
+    FREE:
+        delete arena;
+        return NULL;
+}
+
+Arena::Block* Arena::NewBlock(size_t size) {
+    Block* block = (Block*)malloc(ARENA_HEADER + size);
+    if (!block)
+        return NULL;
+
+    block->Next = NULL;
+    block->Size = size;
+    block->Used = 0;
+    return block;
+}
+
+void*  Arena::Alloc(size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // Blocks after Current are left over from before the last Reset
+    while (Current->Used + size > Current->Size) {
+        if (!Current->Next || Current->Next->Size < size) {
+            Block* block = NewBlock(size > BlockSize ? size : BlockSize);
+            if (!block)
+                return NULL;
+
+            block->Next = Current->Next;
+            Current->Next = block;
+        }
+        Current = Current->Next;
+    }
+
+    void* data = (uint8_t*)Current + ARENA_HEADER + Current->Used;
+    Current->Used += size;
+    return data;
+}
+void*  Arena::Calloc(size_t count, size_t size) {
+    void* data = Alloc(count * size);
+    if (data)
+        memset(data, 0, count * size);
+    return data;
+}
+
+void   Arena::Reset() {
+    for (Block* block = First; block; block = block->Next)
+        block->Used = 0;
+    Current = First;
+}
+void   Arena::Close() {
+    Block* block = First;
+    while (block) {
+        Block* next = block->Next;
+        free(block);
+        block = next;
+    }
+
+    delete this;
+}
@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator for data that all dies at once (everything parsed out of one
+// VOL entry). Allocations are carved out of large blocks and never freed one
+// by one; Reset makes every block reusable without returning it to the
+// system, so an arena that is reset between entries stops allocating once it
+// has grown to the largest entry.
+class Arena {
+public:
+    struct Block {
+        Block* Next;
+        size_t Size;
+        size_t Used;
+    };
+
+    Block* First;
+    Block* Current;
+    size_t BlockSize;
+
+    static Arena* New(size_t blockSize = 0x10000);
+    void*         Alloc(size_t size);
+    void*         Calloc(size_t count, size_t size);
+    void          Reset();
+    void          Close();
+
+private:
+    Block*        NewBlock(size_t size);
+};
+
+#endif /* ARENA_H */
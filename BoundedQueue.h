@@ -0,0 +1,127 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+
+// Fixed-capacity multi-producer multi-consumer ring (Vyukov). Each cell
+// carries a sequence number that says whether it is ready to be written or
+// read on the current lap, so pushes and pops only contend on one atomic
+// each. Push and Pop block (spin, then yield) while full or empty; Pop
+// returns false once every producer has called ProducerDone and the ring is
+// drained.
+template <typename T> class BoundedQueue {
+public:
+    struct Cell {
+        std::atomic<size_t> Sequence;
+        T                   Data;
+    };
+
+    Cell*   Cells = NULL;
+    size_t  Mask = 0;
+    alignas(64) std::atomic<size_t> Head;
+    alignas(64) std::atomic<size_t> Tail;
+    alignas(64) std::atomic<int>    Producers;
+
+    static BoundedQueue<T>* New(size_t capacity, int producers) {
+        // Round up to a power of two so positions wrap with a mask
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        BoundedQueue<T>* queue = new (std::nothrow) BoundedQueue<T>;
+        if (!queue)
+            return NULL;
+
+        queue->Cells = new (std::nothrow) Cell[size];
+        if (!queue->Cells) {
+            delete queue;
+            return NULL;
+        }
+
+        for (size_t i = 0; i < size; i++)
+            queue->Cells[i].Sequence.store(i, std::memory_order_relaxed);
+        queue->Mask = size - 1;
+        queue->Head.store(0, std::memory_order_relaxed);
+        queue->Tail.store(0, std::memory_order_relaxed);
+        queue->Producers.store(producers, std::memory_order_release);
+        return queue;
+    }
+
+    bool TryPush(const T& data) {
+        size_t position = Head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell* cell = &Cells[position & Mask];
+            size_t sequence = cell->Sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+            if (diff == 0) {
+                if (Head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell->Data = data;
+                    cell->Sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // Full
+            else
+                position = Head.load(std::memory_order_relaxed);
+        }
+    }
+    bool TryPop(T* data) {
+        size_t position = Tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell* cell = &Cells[position & Mask];
+            size_t sequence = cell->Sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+            if (diff == 0) {
+                if (Tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    *data = cell->Data;
+                    cell->Sequence.store(position + Mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // Empty
+            else
+                position = Tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    void Push(const T& data) {
+        for (int spins = 0; !TryPush(data); spins++)
+            Backoff(spins);
+    }
+    bool Pop(T* data) {
+        for (int spins = 0; ; spins++) {
+            if (TryPop(data))
+                return true;
+            if (Producers.load(std::memory_order_acquire) == 0)
+                return TryPop(data);
+            Backoff(spins);
+        }
+    }
+    void ProducerDone() {
+        Producers.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    void Close() {
+        delete[] Cells;
+        delete this;
+    }
+
+private:
+    static void Backoff(int spins) {
+        if (spins < 64)
+            return;
+        if (spins < 256)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+};
+
+#endif /* BOUNDEDQUEUE_H */
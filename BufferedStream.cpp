@@ -0,0 +1,121 @@
+#include "BufferedStream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Takes ownership of source; it is closed along with the buffered stream
+BufferedStream* BufferedStream::New(Stream* source, size_t bufferSize) {
+    if (!source) {
+        return NULL;
+    }
+
+    BufferedStream* stream = new BufferedStream;
+    if (!stream) {
+        return NULL;
+    }
+
+    stream->buffer = (uint8_t*)malloc(bufferSize);
+    if (!stream->buffer)
+        goto FREE;
+
+    stream->source = source;
+    stream->bufferSize = bufferSize;
+    stream->bufferStart = source->Position();
+    stream->length = source->Length();
+    stream->ReadCursor = stream->buffer;
+    stream->ReadEnd = stream->buffer;
+    return stream;
+
+    FREE:
+        delete stream;
+        return NULL;
+}
+
+void        BufferedStream::Close() {
+    source->Close();
+    free(buffer);
+    buffer = NULL;
+    ReadCursor = ReadEnd = NULL;
+    Stream::Close();
+}
+void        BufferedStream::Seek(int64_t offset) {
+    if (offset < 0)
+        offset = 0;
+    if ((uint64_t)offset > length)
+        offset = length;
+
+    // Stay in the window if we can, otherwise refill lazily on the next read
+    if ((uint64_t)offset >= bufferStart && (uint64_t)offset <= bufferStart + (ReadEnd - buffer)) {
+        ReadCursor = buffer + (offset - bufferStart);
+        return;
+    }
+
+    bufferStart = (size_t)offset;
+    ReadCursor = ReadEnd = buffer;
+}
+void        BufferedStream::SeekEnd(int64_t offset) {
+    Seek((int64_t)length + offset);
+}
+void        BufferedStream::Skip(int64_t offset) {
+    Seek((int64_t)Position() + offset);
+}
+size_t      BufferedStream::Position() {
+    return bufferStart + (ReadCursor - buffer);
+}
+size_t      BufferedStream::Length() {
+    return length;
+}
+
+void        BufferedStream::Fill() {
+    bufferStart = Position();
+    source->Seek(bufferStart);
+
+    size_t count = source->ReadBytes(buffer, bufferSize);
+    ReadCursor = buffer;
+    ReadEnd = buffer + count;
+}
+size_t      BufferedStream::ReadBytes(void* data, int n) {
+    if (n <= 0)
+        return 0;
+
+    uint8_t* dst = (uint8_t*)data;
+    size_t remaining = (size_t)n;
+    size_t read = 0;
+
+    size_t available = ReadEnd - ReadCursor;
+    if (available) {
+        size_t count = remaining < available ? remaining : available;
+        memcpy(dst, ReadCursor, count);
+        ReadCursor += count;
+        read += count;
+        remaining -= count;
+    }
+    if (!remaining)
+        return read;
+
+    // Large reads go straight to the source instead of through the window
+    if (remaining >= bufferSize) {
+        size_t position = Position();
+        source->Seek(position);
+        size_t count = source->ReadBytes(dst + read, remaining);
+
+        bufferStart = position + count;
+        ReadCursor = ReadEnd = buffer;
+        return read + count;
+    }
+
+    Fill();
+    available = ReadEnd - ReadCursor;
+    size_t count = remaining < available ? remaining : available;
+    memcpy(dst + read, ReadCursor, count);
+    ReadCursor += count;
+    return read + count;
+}
+size_t      BufferedStream::ReadAt(uint64_t offset, void* data, size_t n) {
+    // Bypasses the window, which belongs to the stream's own cursor
+    return source->ReadAt(offset, data, n);
+}
+
+size_t      BufferedStream::WriteBytes(void* data, int n) {
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef BUFFEREDSTREAM_H
+#define BUFFEREDSTREAM_H
+
+#include <stddef.h>
+#include "Stream.h"
+
+// Read-only stream that reads its source a large window at a time, so
+// small reads come out of memory through the inline fast paths.
+class BufferedStream : public Stream {
+public:
+    Stream*  source;
+    uint8_t* buffer;
+    size_t   bufferSize;
+    size_t   bufferStart; // source position of buffer[0]
+    size_t   length;
+
+    static BufferedStream* New(Stream* source, size_t bufferSize = 0x40000);
+    void        Close();
+    void        Seek(int64_t offset);
+    void        SeekEnd(int64_t offset);
+    void        Skip(int64_t offset);
+    size_t      Position();
+    size_t      Length();
+    size_t      ReadBytes(void* data, int n);
+    size_t      ReadAt(uint64_t offset, void* data, size_t n);
+    size_t      WriteBytes(void* data, int n);
+
+private:
+    void        Fill();
+};
+
+#endif /* BUFFEREDSTREAM_H */
@@ -1,17 +1,58 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_syswm.h>
-#include <SDL2/SDL_image.h>
 #include "FileStream.h"
+#include "BufferedStream.h"
+#include "MappedStream.h"
+#include "SubStream.h"
 #include "HashMap.h"
+#include "ThreadPool.h"
+#include "BoundedQueue.h"
+#include "OutputWriter.h"
+#include "TarWriter.h"
+#include "Arena.h"
+#include "SkylinePacker.h"
+#include "PNGWriter.h"
+#include "QOIWriter.h"
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+#endif
+
+#ifdef WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
 
 // Compatibility functions
 bool Directory_Create(const char* folder) {
+    return OutputWriter::CreateDirectories(folder);
+}
+// Returns stdout as a binary FILE* for data, and sends anything printed
+// afterwards to stderr instead so it can't end up in the data
+FILE* Stdout_Detach() {
+    fflush(stdout);
     #if WIN32
-        return CreateDirectoryA(path, NULL);
+        int fd = _dup(1);
+        if (fd < 0 || _dup2(2, 1) < 0)
+            return NULL;
+        _setmode(fd, _O_BINARY);
+        return _fdopen(fd, "wb");
     #else
-        return mkdir(path, 0777) == 0;
+        int fd = dup(1);
+        if (fd < 0 || dup2(2, 1) < 0)
+            return NULL;
+        return fdopen(fd, "wb");
     #endif
-    return false;
 }
 
 // .WAVE format
@@ -87,6 +128,24 @@ struct frame_t {
     frame_piece_t* pieces;
 };
 
+// A frame's pieces resolved into source and destination rectangles, worked
+// out once when the frame is read
+enum {
+    BLIT_BLEND,     // Upright piece, alpha blended by SDL
+    BLIT_COPY,      // Mirrored piece, rows copied over as they are
+    BLIT_TRANSPOSE, // Rotated piece, source columns become destination rows
+};
+struct blit_op_t {
+    uint16_t       texture;
+    uint8_t        mode;
+    SDL_Rect       src;
+    SDL_Rect       dst;
+};
+struct blit_plan_t {
+    blit_op_t*     ops;
+    int            count;
+};
+
 struct texture_entries_header_t {
     uint32_t       magic; // 0xD3CE76CA
     uint32_t       unknown;
@@ -111,9 +170,10 @@ struct anim_t {
     vector<anim_entry_t>     entries;
     vector<char*>            entryNames;
     vector<frame_t>          frames;
+    vector<blit_plan_t>      framePlans;
     vector<texture_entry_t>  textures;
-    vector<SDL_Surface*>     frameSurfaces;
-    vector<SDL_Surface*>     textureSurfaces;
+    vector<SDL_Surface*>     textureSurfaces; // NULL until decoded
+    Stream*                  textureReader;
 };
 
 // .IMAGE format
@@ -129,9 +189,23 @@ struct image_t {
     uint32_t                 file_offset;
     image_header_t           header;
     frame_t                  frame;
+    blit_plan_t              framePlan;
     texture_entries_header_t texture_entries_header;
     vector<texture_entry_t>  textures;
-    vector<SDL_Surface*>     textureSurfaces;
+    vector<SDL_Surface*>     textureSurfaces; // NULL until decoded
+    Stream*                  textureReader;
+};
+
+// The textures of an ANIM or IMAGE while its frames are drawn. Each texture
+// is decoded the first time a frame piece needs it (normally in the decode
+// stage, ahead of drawing). An ANIM releases each one after the last sheet
+// drawing from it; anything left goes once the entry is done.
+struct texture_set_t {
+    vector<texture_entry_t>* entries;
+    vector<SDL_Surface*>*    surfaces;
+    uint64_t                 file_offset;
+    Stream*                  reader;
+    bool                     readOnly = false; // Set while drawn from on several threads; nothing more is decoded
 };
 
 // .VOL format
@@ -171,6 +245,160 @@ struct vol_t {
     vol_file_t*           files;
     vector<char*>         fileStrings;
     HashMap<vol_file_t*>* fileMap;
+    MappedStream*         index; // non-NULL when files/fileStrings point into a mapped index
+};
+
+// .VOL directory index (sidecar cache, "<vol>.idx")
+struct vol_index_header_t {
+    uint32_t     magic; // 'VIDX'
+    uint32_t     version;
+    uint64_t     vol_size;
+    int64_t      vol_mtime;
+    vol_header_t vol_header;
+    uint32_t     file_offset;
+    uint32_t     file_count;
+    uint32_t     files_offset;
+    uint32_t     name_offsets_offset;
+    uint32_t     names_offset;
+    uint32_t     names_size;
+    uint32_t     map_offset;
+    uint32_t     map_capacity;
+};
+struct vol_index_slot_t {
+    uint32_t key;
+    uint32_t file_index; // 0xFFFFFFFF when the slot is unused
+};
+
+// Read-only views over an entry's bytes. Nothing is copied or allocated:
+// tables are read in place and names point into the entry, so the views are
+// only valid while those bytes are (the VOL mapping or the entry buffer).
+template <typename T> T ViewLoad(const uint8_t* p) {
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+struct bytes_view_t {
+    const uint8_t* data;
+    size_t         size;
+
+    bool           Contains(uint64_t offset, uint64_t length) const {
+        return offset <= size && length <= size - offset;
+    }
+    const char*    String(uint64_t offset) const {
+        if (offset >= size || !memchr(data + offset, 0, size - offset))
+            return NULL;
+        return (const char*)(data + offset);
+    }
+};
+
+struct frame_view_t {
+    const uint8_t* data;   // frame header (frame_t without the pieces pointer)
+    const uint8_t* pieces;
+
+    uint16_t       PieceCount() const { return ViewLoad<uint16_t>(data + offsetof(frame_t, piece_count)); }
+    uint32_t       Width() const      { return ViewLoad<uint32_t>(data + offsetof(frame_t, width)); }
+    uint32_t       Height() const     { return ViewLoad<uint32_t>(data + offsetof(frame_t, height)); }
+    frame_piece_t  Piece(int i) const { return ViewLoad<frame_piece_t>(pieces + i * sizeof(frame_piece_t)); }
+
+    bool           Open(bytes_view_t bytes, uint64_t offset) {
+        if (!bytes.Contains(offset, offsetof(frame_t, pieces)))
+            return false;
+
+        data = bytes.data + offset;
+        uint32_t header_size = ViewLoad<uint32_t>(data + offsetof(frame_t, header_size));
+        if (!bytes.Contains(offset + header_size, (uint64_t)PieceCount() * sizeof(frame_piece_t)))
+            return false;
+
+        pieces = data + header_size;
+        return true;
+    }
+};
+
+struct textures_view_t {
+    texture_entries_header_t header;
+    const uint8_t*           entries;
+
+    uint32_t        Count() const       { return header.texture_count; }
+    texture_entry_t Texture(int i) const { return ViewLoad<texture_entry_t>(entries + i * sizeof(texture_entry_t)); }
+
+    bool            Open(bytes_view_t bytes, uint64_t offset) {
+        if (!bytes.Contains(offset, sizeof(header)))
+            return false;
+
+        header = ViewLoad<texture_entries_header_t>(bytes.data + offset);
+        if (!bytes.Contains(offset + sizeof(header), (uint64_t)header.texture_count * sizeof(texture_entry_t)))
+            return false;
+
+        entries = bytes.data + offset + sizeof(header);
+        return true;
+    }
+};
+
+struct anim_view_t {
+    bytes_view_t    bytes;
+    anim_header_t   header;
+    const uint8_t*  entryTable; // 0x14-byte anim_entry_t records
+    const uint8_t*  frameList;  // uint32_t frame offsets
+    textures_view_t textures;
+
+    int             EntryCount() const { return header.anim_entry_count; }
+    int             FrameCount() const { return header.frame_count; }
+    anim_entry_t    Entry(int i) const {
+        anim_entry_t entry;
+        memcpy(&entry, entryTable + i * 0x14, 0x14);
+        entry.frame_data = NULL;
+        return entry;
+    }
+    const char*     EntryName(int i) const { return bytes.String(Entry(i).offset_to_string); }
+    bool            EntryFrame(int i, uint32_t f, frame_data_t* frame) const {
+        anim_entry_t entry = Entry(i);
+        if (f >= entry.frame_count || !bytes.Contains(entry.frame_data_offset + (uint64_t)f * sizeof(frame_data_t), sizeof(frame_data_t)))
+            return false;
+
+        *frame = ViewLoad<frame_data_t>(bytes.data + entry.frame_data_offset + f * sizeof(frame_data_t));
+        return true;
+    }
+    bool            Frame(int i, frame_view_t* frame) const {
+        return frame->Open(bytes, ViewLoad<uint32_t>(frameList + i * sizeof(uint32_t)));
+    }
+
+    bool            Open(const uint8_t* data, size_t size) {
+        bytes.data = data;
+        bytes.size = size;
+        if (!bytes.Contains(0, sizeof(header)))
+            return false;
+
+        header = ViewLoad<anim_header_t>(data);
+
+        // Same layout ReadANIM walks: header, <version> words, a count, then the entry table
+        uint64_t entryTableOffset = sizeof(header) + header.version * sizeof(uint32_t) + sizeof(uint32_t);
+        if (!bytes.Contains(entryTableOffset, header.anim_entry_count * 0x14ULL)
+            || !bytes.Contains(header.frame_list_offset, header.frame_count * (uint64_t)sizeof(uint32_t)))
+            return false;
+
+        entryTable = data + entryTableOffset;
+        frameList = data + header.frame_list_offset;
+        return textures.Open(bytes, header.texture_entries_header_offset);
+    }
+};
+
+struct image_view_t {
+    bytes_view_t    bytes;
+    image_header_t  header;
+    frame_view_t    frame;
+    textures_view_t textures;
+
+    bool            Open(const uint8_t* data, size_t size) {
+        bytes.data = data;
+        bytes.size = size;
+        if (!bytes.Contains(0, sizeof(header)))
+            return false;
+
+        header = ViewLoad<image_header_t>(data);
+        return frame.Open(bytes, header.frame_offset)
+            && textures.Open(bytes, header.texture_entries_header_offset);
+    }
 };
 
 struct RSDK_AnimFrame {
@@ -193,113 +421,382 @@ struct RSDK_Animation {
     vector<RSDK_AnimFrame> Frames;
 };
 
-uint8_t Font8x8_basic[128][8];
+// dst[r][c] = src[c][r] for r < rows, c < cols, in cache-sized blocks so
+// both sides stay in cache; with SSE2, 4x4 pixel blocks are transposed in
+// registers.
+void         TransposePixels(uint32_t* dst, int dstPitch, const uint32_t* src, int srcPitch, int rows, int cols) {
+    const int block = 32;
+    for (int rb = 0; rb < rows; rb += block) {
+        int re = rb + block < rows ? rb + block : rows;
+        for (int cb = 0; cb < cols; cb += block) {
+            int ce = cb + block < cols ? cb + block : cols;
+
+            int r = rb;
+#if defined(__SSE2__) || defined(_M_X64)
+            for (; r + 4 <= re; r += 4) {
+                int c = cb;
+                for (; c + 4 <= ce; c += 4) {
+                    __m128 row0 = _mm_loadu_ps((const float*)(src + (c + 0) * srcPitch + r));
+                    __m128 row1 = _mm_loadu_ps((const float*)(src + (c + 1) * srcPitch + r));
+                    __m128 row2 = _mm_loadu_ps((const float*)(src + (c + 2) * srcPitch + r));
+                    __m128 row3 = _mm_loadu_ps((const float*)(src + (c + 3) * srcPitch + r));
+                    _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+                    _mm_storeu_ps((float*)(dst + (r + 0) * dstPitch + c), row0);
+                    _mm_storeu_ps((float*)(dst + (r + 1) * dstPitch + c), row1);
+                    _mm_storeu_ps((float*)(dst + (r + 2) * dstPitch + c), row2);
+                    _mm_storeu_ps((float*)(dst + (r + 3) * dstPitch + c), row3);
+                }
+                for (; c < ce; c++) {
+                    for (int k = 0; k < 4; k++)
+                        dst[(r + k) * dstPitch + c] = src[c * srcPitch + r + k];
+                }
+            }
+#endif
+            for (; r < re; r++) {
+                uint32_t* row = dst + r * dstPitch;
+                for (int c = cb; c < ce; c++)
+                    row[c] = src[c * srcPitch + r];
+            }
+        }
+    }
+}
+
+// Trims a run of n pixels starting at a in one surface and b in the other so
+// both stay inside their sizes; returns the first index kept
+static int   ClipRun(int a, int sizeA, int b, int sizeB, int* n) {
+    int start = 0;
+    if (a < 0 && start < -a) start = -a;
+    if (b < 0 && start < -b) start = -b;
 
-void         BlitText(SDL_Surface* dstSurf, const char* string, int x, int y, Uint32 color) {
-    uint32_t* dstP = (uint32_t*)dstSurf->pixels;
+    int end = *n;
+    if (a + end > sizeA) end = sizeA - a;
+    if (b + end > sizeB) end = sizeB - b;
 
-    for (size_t i = 0; i < strlen(string); i++) {
-		for (int by = 0; by < 8; by++) {
-			for (int bx = 0; bx < 8; bx++) {
-				if (Font8x8_basic[(int)string[i]][by] & 1 << bx) {
-					dstP[(x + bx + i * 8) + (y + by) * dstSurf->w] = color;
-				}
-			}
-		}
-	}
-}
-void         BlitSurfaceTexture(SDL_Surface* dstSurf, SDL_Surface* srcSurf, SDL_Rect* dst, SDL_Rect* src, bool flip_x, bool flip_y) {
-    // printf("x (src): %d\n", src->x);
-    // printf("y (src): %d\n", src->y);
-    // printf("w (src): %d\n", src->w);
-    // printf("h (src): %d\n", src->h);
-    //
-    // printf("x (dst): %d\n", dst->x);
-    // printf("y (dst): %d\n", dst->y);
-    // printf("w (dst): %d\n", dst->w);
-    // printf("h (dst): %d\n", dst->h);
-    //
-    // printf("flip_x: %s\n", flip_x ? "TRUE" : "FALSE");
-    // printf("flip_y: %s\n", flip_y ? "TRUE" : "FALSE");
-    //
-    // printf("\n");
+    *n = end > start ? end - start : 0;
+    return start;
+}
 
-    bool rotate = src->w != dst->w;
+// Source-over blend of one RGBA8888 pixel, with the same arithmetic as SDL's
+// RGB-to-RGB per-pixel alpha blitter so output matches SDL_BlitSurface
+static inline uint32_t BlendPixel(uint32_t s, uint32_t d) {
+    uint32_t alpha = s >> 24;
+    if (alpha == 0xFF)
+        return s;
+    if (!alpha)
+        return d;
+
+    uint32_t dalpha = d >> 24;
+    uint32_t s1 = s & 0xFF00FF;
+    uint32_t d1 = d & 0xFF00FF;
+    d1 = (d1 + ((s1 - d1) * alpha >> 8)) & 0xFF00FF;
+    s &= 0xFF00;
+    d &= 0xFF00;
+    d = (d + ((s - d) * alpha >> 8)) & 0xFF00;
+    dalpha = alpha + (dalpha * (alpha ^ 0xFF) >> 8);
+    return d1 | d | dalpha << 24;
+}
+
+void         RunBlitOp(SDL_Surface* dstSurf, SDL_Surface* srcSurf, blit_op_t* op, int x, int y) {
+    SDL_Rect src = op->src;
+    SDL_Rect dst = op->dst;
+    dst.x += x;
+    dst.y += y;
 
     uint32_t* dstP = (uint32_t*)dstSurf->pixels;
     uint32_t* srcP = (uint32_t*)srcSurf->pixels;
-
-    if (!rotate && !flip_x && !flip_y) {
-        SDL_BlitSurface(srcSurf, src, dstSurf, dst);
-    }
-    else {
-        int dx, dy, sx, sy;
-        if (rotate) {
-            for (int i = 0; i < dst->w * dst->h; i++) {
-                dx = dst->x + (i % dst->w);
-                dy = dst->y + (i / dst->w);
-                sx = src->x + (i / dst->w);
-                sy = src->y + (i % dst->w);
-
-                dstP[dx + dy * dstSurf->w] = srcP[sx + sy * srcSurf->w];
+    int dstPitch = dstSurf->pitch / 4;
+    int srcPitch = srcSurf->pitch / 4;
+
+    switch (op->mode) {
+        case BLIT_BLEND: {
+            // Blended here rather than with SDL_BlitSurface, which keeps blit
+            // state on both surfaces; textures are shared between threads
+            // through the texture cache and only ever read
+            int cols = src.w, rows = src.h;
+            int c0 = ClipRun(dst.x, dstSurf->w, src.x, srcSurf->w, &cols);
+            int r0 = ClipRun(dst.y, dstSurf->h, src.y, srcSurf->h, &rows);
+            for (int r = r0; r < r0 + rows; r++) {
+                uint32_t* dstRow = dstP + (dst.y + r) * dstPitch + dst.x + c0;
+                const uint32_t* srcRow = srcP + (src.y + r) * srcPitch + src.x + c0;
+                for (int c = 0; c < cols; c++)
+                    dstRow[c] = BlendPixel(srcRow[c], dstRow[c]);
             }
+            break;
         }
-        else {
-            for (int i = 0; i < dst->w * dst->h; i++) {
-                dx = dst->x + (i % dst->w);
-                dy = dst->y + (i / dst->w);
-                sx = src->x + (i % dst->w);
-                sy = src->y + (i / dst->w);
+        case BLIT_COPY: {
+            int cols = dst.w, rows = dst.h;
+            int c0 = ClipRun(dst.x, dstSurf->w, src.x, srcSurf->w, &cols);
+            int r0 = ClipRun(dst.y, dstSurf->h, src.y, srcSurf->h, &rows);
+            for (int r = r0; r < r0 + rows; r++) {
+                memcpy(dstP + (dst.y + r) * dstPitch + dst.x + c0,
+                    srcP + (src.y + r) * srcPitch + src.x + c0,
+                    cols * sizeof(uint32_t));
+            }
+            break;
+        }
+        case BLIT_TRANSPOSE: {
+            // Destination row r is source column src.x + r
+            int cols = dst.w, rows = dst.h;
+            int c0 = ClipRun(dst.x, dstSurf->w, src.y, srcSurf->h, &cols);
+            int r0 = ClipRun(dst.y, dstSurf->h, src.x, srcSurf->w, &rows);
+            TransposePixels(dstP + (dst.y + r0) * dstPitch + dst.x + c0, dstPitch,
+                srcP + (src.y + c0) * srcPitch + src.x + r0, srcPitch,
+                rows, cols);
+            break;
+        }
+    }
+}
+
+// 3DS textures are stored as 8x8 tiles, left to right then top to bottom,
+// with the pixels of each tile in Morton (Z) order: x comes from the even
+// bits of the index, y from the odd bits. This is the tile index of each
+// pixel, row by row.
+static const uint8_t MortonTileOrder[64] = {
+     0,  1,  4,  5, 16, 17, 20, 21,
+     2,  3,  6,  7, 18, 19, 22, 23,
+     8,  9, 12, 13, 24, 25, 28, 29,
+    10, 11, 14, 15, 26, 27, 30, 31,
+    32, 33, 36, 37, 48, 49, 52, 53,
+    34, 35, 38, 39, 50, 51, 54, 55,
+    40, 41, 44, 45, 56, 57, 60, 61,
+    42, 43, 46, 47, 58, 59, 62, 63,
+};
+
+// Converts one texture from tiled RGB565 plus 4-bit alpha straight to linear
+// RGBA8888 in a single pass. Each row of a tile is four pairs of
+// horizontally adjacent pixels; a pair is one 32-bit word of color in the
+// tile and one byte of alpha (low nibble on the left), both at the same
+// index. Channels are widened by shifting, as SDL's 565 converter does.
+static void  DecodeTextureTiles(uint32_t* dst, int pitch, const uint16_t* colors, const uint8_t* alphas, int width, int pixel_count) {
+    int tilesPerRow = width >> 3;
+    int tileCount = pixel_count >> 6;
+    for (int t = 0; t < tileCount; t++) {
+        const uint8_t* tileColors = (const uint8_t*)(colors + t * 64);
+        const uint8_t* tileAlphas = alphas + t * 32;
+        uint32_t* row = dst + (t % tilesPerRow) * 8 + (t / tilesPerRow) * 8 * pitch;
+
+        for (int y = 0; y < 8; y++, row += pitch) {
+            const uint8_t* order = MortonTileOrder + y * 8;
+#if defined(__SSE2__) || defined(_M_X64)
+            uint32_t pairs[4];
+            uint32_t codes = 0;
+            for (int k = 0; k < 4; k++) {
+                int pair = order[k * 2] >> 1;
+                memcpy(&pairs[k], tileColors + pair * 4, 4);
+                codes |= (uint32_t)tileAlphas[pair] << (k * 8);
+            }
+
+            __m128i c = _mm_loadu_si128((const __m128i*)pairs);
+            __m128i r = _mm_and_si128(_mm_srli_epi16(c, 8), _mm_set1_epi16(0xF8));
+            __m128i g = _mm_and_si128(_mm_slli_epi16(c, 5), _mm_set1_epi16((short)0xFC00));
+            __m128i b = _mm_and_si128(_mm_slli_epi16(c, 3), _mm_set1_epi16(0xF8));
+
+            // Nibbles to one alpha per 16-bit lane: even lanes take the low
+            // nibble (x16 then >>4), odd lanes the high one
+            __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)codes), _mm_setzero_si128());
+            a = _mm_unpacklo_epi16(a, a);
+            a = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(a, _mm_set_epi16(1, 16, 1, 16, 1, 16, 1, 16)), 4), _mm_set1_epi16(0xF));
+            a = _mm_or_si128(a, _mm_slli_epi16(a, 4));
+
+            __m128i rg = _mm_or_si128(r, g);
+            __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+            _mm_storeu_si128((__m128i*)row, _mm_unpacklo_epi16(rg, ba));
+            _mm_storeu_si128((__m128i*)(row + 4), _mm_unpackhi_epi16(rg, ba));
+#else
+            for (int x = 0; x < 8; x++) {
+                uint16_t color;
+                memcpy(&color, tileColors + order[x] * 2, 2);
+                uint32_t alpha = (tileAlphas[order[x] >> 1] >> ((order[x] & 1) << 2)) & 0xF;
+                    alpha = alpha | alpha << 4;
 
-                dstP[dx + dy * dstSurf->w] = srcP[sx + sy * srcSurf->w];
+                row[x] = ((color >> 8) & 0xF8)
+                    | ((color << 5) & 0xFC00)
+                    | ((color << 19) & 0xF80000)
+                    | (alpha << 24);
             }
+#endif
         }
     }
 }
 
-SDL_Surface* GetPixelsFromTextureEntry(texture_entry_t entry, uint64_t file_offset, FileStream* reader) {
-    SDL_Surface* result;
+// Per-thread buffers reused from one texture to the next
+thread_local vector<uint8_t> scratchColors;
+thread_local vector<uint8_t> scratchAlphas;
+
+// Decoded textures, shared between entries whose texture data is identical.
+// Surfaces handed out are SDL reference counted: the cache holds one
+// reference, each user another, and ReleaseTexture drops a user's. When the
+// cached surfaces go over textureCacheLimit bytes, the least recently used
+// lose the cache's reference. SDL's refcount isn't atomic, so every change to
+// it on a shared surface happens under the cache lock.
+struct texture_key_t {
+    uint64_t color_hash;
+    uint64_t alpha_hash;
+    uint32_t pixel_count;
+    uint8_t  size_factor;
+};
+struct texture_cache_entry_t {
+    texture_key_t key;
+    SDL_Surface*  surface;
+    size_t        bytes;
+};
+struct texture_cache_t {
+    std::mutex                                                     lock;
+    std::list<texture_cache_entry_t>                               entries; // Most recently used first
+    std::unordered_map<uint64_t, std::list<texture_cache_entry_t>::iterator> entryMap;
+    size_t                                                         bytes = 0;
+    size_t                                                         hits = 0;
+    size_t                                                         misses = 0;
+};
 
-    int pixel_count = (entry.pixel_count << (entry.size_factor + 3));
+size_t          textureCacheLimit = 256 << 20;
+texture_cache_t textureCache;
+
+// Hashes 8 bytes at a time; texture payloads are tens of kilobytes
+uint64_t     HashTextureBytes(const uint8_t* data, size_t size) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
 
-    Uint16* pixels = (Uint16*)malloc(pixel_count * sizeof(Uint16));
-    reader->Seek(file_offset + entry.color_offset);
-    reader->ReadBytes(&pixels, pixel_count * sizeof(Uint16));
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+uint64_t     GetTextureKeyHash(texture_key_t* key) {
+    return key->color_hash ^ (key->alpha_hash * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)key->pixel_count << 8 | key->size_factor);
+}
+bool         IsTextureKeyEqual(texture_key_t* a, texture_key_t* b) {
+    return a->color_hash == b->color_hash
+        && a->alpha_hash == b->alpha_hash
+        && a->pixel_count == b->pixel_count
+        && a->size_factor == b->size_factor;
+}
 
-    Uint8* codes = (Uint8*)malloc(pixel_count * sizeof(Uint8));
-    reader->Seek(file_offset + entry.alpha_offset);
-    reader->ReadBytes(&codes, pixel_count * sizeof(Uint8));
+// Returns a new reference to the cached surface, or NULL
+SDL_Surface* AcquireCachedTexture(texture_key_t* key) {
+    std::lock_guard<std::mutex> guard(textureCache.lock);
+    auto it = textureCache.entryMap.find(GetTextureKeyHash(key));
+    if (it == textureCache.entryMap.end() || !IsTextureKeyEqual(&it->second->key, key)) {
+        textureCache.misses++;
+        return NULL;
+    }
 
-    int textureWidth = 1 << entry.size_factor;
-    int textureHeight = pixel_count / textureWidth;
+    textureCache.entries.splice(textureCache.entries.begin(), textureCache.entries, it->second);
+    textureCache.hits++;
 
-    Uint32 depth = 16;
-    Uint32 pitch = (depth >> 3) * textureWidth;
-    Uint32 pixel_format = SDL_PIXELFORMAT_RGB565;
+    SDL_Surface* surface = it->second->surface;
+    surface->refcount++;
+    return surface;
+}
+// Offers a freshly decoded surface to the cache and returns the one to use
+// (another thread may have cached the same texture in the meantime)
+SDL_Surface* PutCachedTexture(texture_key_t* key, SDL_Surface* surface) {
+    size_t bytes = (size_t)surface->pitch * surface->h;
+    if (bytes > textureCacheLimit)
+        return surface;
+
+    std::lock_guard<std::mutex> guard(textureCache.lock);
+    uint64_t hash = GetTextureKeyHash(key);
+    auto it = textureCache.entryMap.find(hash);
+    if (it != textureCache.entryMap.end()) {
+        if (!IsTextureKeyEqual(&it->second->key, key))
+            return surface;
+
+        SDL_FreeSurface(surface);
+        surface = it->second->surface;
+        surface->refcount++;
+        return surface;
+    }
+
+    texture_cache_entry_t entry;
+    entry.key = *key;
+    entry.surface = surface;
+    entry.bytes = bytes;
+    surface->refcount++;
+
+    textureCache.entries.push_front(entry);
+    textureCache.entryMap[hash] = textureCache.entries.begin();
+    textureCache.bytes += bytes;
+
+    while (textureCache.bytes > textureCacheLimit) {
+        texture_cache_entry_t* oldest = &textureCache.entries.back();
+        textureCache.bytes -= oldest->bytes;
+        textureCache.entryMap.erase(GetTextureKeyHash(&oldest->key));
+        SDL_FreeSurface(oldest->surface);
+        textureCache.entries.pop_back();
+    }
+    return surface;
+}
+void         ReleaseTexture(SDL_Surface* surface) {
+    if (!textureCacheLimit) {
+        SDL_FreeSurface(surface);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(textureCache.lock);
+    SDL_FreeSurface(surface);
+}
+void         ClearTextureCache() {
+    std::lock_guard<std::mutex> guard(textureCache.lock);
+    for (auto it = textureCache.entries.begin(); it != textureCache.entries.end(); ++it)
+        SDL_FreeSurface(it->surface);
+    textureCache.entries.clear();
+    textureCache.entryMap.clear();
+    textureCache.bytes = 0;
+}
 
-    Uint16* pixelSurface = (Uint16*)malloc(pitch * textureHeight * sizeof(Uint16));
-    memset(pixelSurface, 0, pitch * textureHeight * sizeof(Uint16));
+SDL_Surface* GetPixelsFromTextureEntry(texture_entry_t entry, uint64_t file_offset, Stream* reader) {
+    SDL_Surface* result;
 
-    bool running = true;
-    int blockCount = 1 << (entry.size_factor - 3);
-    int blockMask = blockCount - 1;
+    // Textures are whole 8x8 tiles, so anything narrower than a tile is
+    // corrupt (and would leave DecodeTextureTiles no tiles per row). Nothing
+    // real is wider than 4096 pixels, and both planes have to be in the
+    // entry.
+    if (entry.size_factor < 3 || entry.size_factor > 12)
+        return NULL;
 
-    Uint16* surfSrc = (Uint16*)pixels;
-    Uint16* surfDst = (Uint16*)pixelSurface;
-    for (int d = 0; running; d++) {
-        int x_start = (d & blockMask) * 8;
-        int y_start = (d / blockCount) * 8;
-        int p_start = d * 64;
+    uint64_t texture_pixels = (uint64_t)entry.pixel_count << (entry.size_factor + 3);
+    if (texture_pixels > 4096 * 4096
+        || file_offset + entry.color_offset + texture_pixels * sizeof(Uint16) > reader->Length()
+        || file_offset + entry.alpha_offset + texture_pixels / 2 > reader->Length())
+        return NULL;
 
-        for (int p = 0; p < 64; p++) {
-            if (p_start + p >= pixel_count) { running = false; break; }
+    int pixel_count = (int)texture_pixels;
 
-            int x = (p >> 0 & 1) + ((p >> 2 & 1) << 1) + ((p >> 4 & 1) << 2);
-            int y = (p >> 1 & 1) + ((p >> 3 & 1) << 1) + ((p >> 5 & 1) << 2);
-            surfDst[(x_start + x) + (y_start + y) * textureWidth] = surfSrc[p_start + p];
-        }
+    scratchColors.resize(pixel_count * sizeof(Uint16));
+    Uint16* pixels = (Uint16*)scratchColors.data();
+    reader->Seek(file_offset + entry.color_offset);
+    reader->ReadBytes(pixels, pixel_count * sizeof(Uint16));
+
+    // 4 bits of alpha per pixel
+    scratchAlphas.resize(pixel_count / 2);
+    Uint8* codes = scratchAlphas.data();
+    reader->Seek(file_offset + entry.alpha_offset);
+    reader->ReadBytes(codes, pixel_count / 2);
+
+    texture_key_t key;
+    if (textureCacheLimit) {
+        key.color_hash = HashTextureBytes((uint8_t*)pixels, pixel_count * sizeof(Uint16));
+        key.alpha_hash = HashTextureBytes(codes, pixel_count / 2);
+        key.pixel_count = entry.pixel_count;
+        key.size_factor = entry.size_factor;
+
+        result = AcquireCachedTexture(&key);
+        if (result)
+            return result;
     }
 
+    int textureWidth = 1 << entry.size_factor;
+    int textureHeight = pixel_count / textureWidth;
+
     // NOTE: Texture Unswizzling code taken from SDL2 PSP rendering
     // int j;
     // unsigned char *ydst = (unsigned char *)data;
@@ -339,49 +836,44 @@ SDL_Surface* GetPixelsFromTextureEntry(texture_entry_t entry, uint64_t file_offs
     // 	}
     // }
 
-    SDL_Surface* image565 = SDL_CreateRGBSurfaceWithFormatFrom((void*)pixelSurface, textureWidth, textureHeight, depth, pitch, pixel_format);
-    result = SDL_ConvertSurfaceFormat(image565, SDL_PIXELFORMAT_RGBA32, 0);
-
-    // Apply alphas
-    bool applyAlphas = true;
-    bool allOrNothing = false;
-    if (applyAlphas) {
-        bool running = true;
-        for (int d = 0; running; d++) {
-            int x_start = (d & blockMask) * 8;
-            int y_start = (d / blockCount) * 8;
-            int p_start = d * 64;
+    result = SDL_CreateRGBSurfaceWithFormat(0, textureWidth, textureHeight, 32, SDL_PIXELFORMAT_RGBA32);
+    if (result)
+        DecodeTextureTiles((uint32_t*)result->pixels, result->pitch / 4, pixels, codes, textureWidth, pixel_count);
 
-            for (int p = 0; p < 64; p++) {
-                if (p_start + p >= pixel_count) { running = false; break; }
-
-                int x = (p >> 0 & 1) + ((p >> 2 & 1) << 1) + ((p >> 4 & 1) << 2);
-                int y = (p >> 1 & 1) + ((p >> 3 & 1) << 1) + ((p >> 5 & 1) << 2);
-                uint32_t* pixel = ((uint32_t*)result->pixels) + (x_start + x) + (y_start + y) * textureWidth;
-
-                int pixelIndex = p_start + p;
-                int alpha = (codes[pixelIndex >> 1] >> (((pixelIndex & 1) << 2)) ) & 0xF;
-                    alpha = alpha | alpha << 4;
-                if (allOrNothing && alpha < 0xFF)
-                    alpha = 0x00;
-                *pixel = (*pixel & 0x00FFFFFF) | (alpha << 24);
-            }
-        }
-    }
+    if (result && textureCacheLimit)
+        result = PutCachedTexture(&key, result);
+    return result;
+}
 
-    free(pixelSurface);
-    free(pixels);
-    free(codes);
+SDL_Surface* GetTexture(texture_set_t* set, uint16_t id) {
+    if (id >= set->surfaces->size())
+        return NULL;
 
-    SDL_FreeSurface(image565);
-    return result;
+    SDL_Surface** surface = &(*set->surfaces)[id];
+    if (!*surface && !set->readOnly)
+        *surface = GetPixelsFromTextureEntry((*set->entries)[id], set->file_offset, set->reader);
+    return *surface;
+}
+void         ReleaseTexture(texture_set_t* set, size_t id) {
+    SDL_Surface** surface = &(*set->surfaces)[id];
+    if (*surface)
+        ReleaseTexture(*surface);
+    *surface = NULL;
+}
+void         ReleaseTextures(texture_set_t* set) {
+    for (size_t t = 0; t < set->surfaces->size(); t++)
+        ReleaseTexture(set, t);
 }
 
-void         BlitSurfaceFromFrame(SDL_Surface* dstSurf, vector<SDL_Surface*>* textures, frame_t frame, int x, int y) {
+blit_plan_t  BuildBlitPlan(frame_t* frame, Arena* arena) {
+    blit_plan_t plan;
+    plan.count = frame->piece_count;
+    plan.ops = (blit_op_t*)arena->Alloc(plan.count * sizeof(blit_op_t));
+
     int flip_x = 0;
     int flip_y = 0;
-    for (int i = 0; i < frame.piece_count; i++) {
-        frame_piece_t p = frame.pieces[i];
+    for (int i = 0; i < frame->piece_count; i++) {
+        frame_piece_t p = frame->pieces[i];
 
         uint16_t min_src_x = p.src[0].v[flip_x] < p.src[1].v[flip_x] ? p.src[0].v[flip_x] : p.src[1].v[flip_x];
         uint16_t min_src_y = p.src[2].v[flip_y] < p.src[3].v[flip_x] ? p.src[2].v[flip_y] : p.src[3].v[flip_x];
@@ -393,98 +885,151 @@ void         BlitSurfaceFromFrame(SDL_Surface* dstSurf, vector<SDL_Surface*>* te
         uint16_t max_dst_x = p.dst[0].v[flip_x] > p.dst[1].v[flip_x] ? p.dst[0].v[flip_x] : p.dst[1].v[flip_x];
         uint16_t max_dst_y = p.dst[2].v[flip_y] > p.dst[3].v[flip_x] ? p.dst[2].v[flip_y] : p.dst[3].v[flip_x];
 
-        min_dst_y = frame.height - min_dst_y;
-        max_dst_y = frame.height - max_dst_y;
+        min_dst_y = frame->height - min_dst_y;
+        max_dst_y = frame->height - max_dst_y;
 
         uint16_t swap = min_dst_y;
         min_dst_y = max_dst_y;
         max_dst_y = swap;
 
-        SDL_Rect src = {
+        blit_op_t* op = &plan.ops[i];
+        op->texture = p.id;
+        op->src = {
             min_src_x,  min_src_y,
             max_src_x - min_src_x,
             max_src_y - min_src_y
         };
-        SDL_Rect dst = {
-            x + min_dst_x, y + min_dst_y,
+        op->dst = {
+            min_dst_x, min_dst_y,
             max_dst_x - min_dst_x,
             max_dst_y - min_dst_y
         };
 
-        // SDL_FillRect(dstSurf, &dst, 0xFFFF00FF);
-        BlitSurfaceTexture(dstSurf, (*textures)[p.id], &dst, &src, p.dst[1].v[flip_x] == min_dst_x, p.dst[2].v[flip_y] == min_dst_y);
+        bool rotate = op->src.w != op->dst.w;
+        bool mirror = p.dst[1].v[flip_x] == min_dst_x || p.dst[2].v[flip_y] == min_dst_y;
+        if (rotate)
+            op->mode = BLIT_TRANSPOSE;
+        else if (mirror)
+            op->mode = BLIT_COPY;
+        else
+            op->mode = BLIT_BLEND;
     }
+    return plan;
 }
-SDL_Surface* GetSurfaceFromFrame(vector<SDL_Surface*>* textures, frame_t frame) {
-    SDL_Surface* result = SDL_CreateRGBSurfaceWithFormat(0, frame.width, frame.height, 32, SDL_PIXELFORMAT_RGBA32);
-
-    BlitSurfaceFromFrame(result, textures, frame, 0, 0);
+void         BlitSurfaceFromFrame(SDL_Surface* dstSurf, texture_set_t* textures, blit_plan_t* plan, int x, int y) {
+    for (int i = 0; i < plan->count; i++) {
+        SDL_Surface* texture = GetTexture(textures, plan->ops[i].texture);
+        if (!texture)
+            continue;
 
-    return result;
+        RunBlitOp(dstSurf, texture, &plan->ops[i], x, y);
+    }
 }
+SDL_Surface* GetSurfaceFromFrame(texture_set_t* textures, frame_t* frame, blit_plan_t* plan) {
+    SDL_Surface* result = SDL_CreateRGBSurfaceWithFormat(0, frame->width, frame->height, 32, SDL_PIXELFORMAT_RGBA32);
 
-void         ReadADPCMChannel(wave_t* wave, FileStream* reader, int cur_channel) {
-    int sample_byte = 0;
-    int first_sample = 0;
-    int sample_count_total = wave->header.sample_count;
-
-    int nibble_to_int[16] = { 0, 1, 2, 3, 4, 5, 6, 7, -8, -7, -6, -5, -4, -3, -2, -1 };
-
-    reader->Seek(wave->file_offset + wave->header.start_offset + wave->header.interleave * cur_channel);
-
-    // reader->Seek(wave->file_offset + wave->header.start_offset + wave->header.interleave * cur_channel
-    //     + framesin * 8);
+    BlitSurfaceFromFrame(result, textures, plan, 0, 0);
 
-    int sample_count = 0;
-    for (;;) {
-        int samples_to_do = 14;
-        if (sample_count_total < samples_to_do)
-            samples_to_do = sample_count_total;
-
-        sample_count_total -= samples_to_do;
-        if (sample_count_total == 0)
-            break;
-
-        Uint8 header = reader->ReadByte();
-
-        int scale = 1 << (header & 0xF);
-        int coef_index = (header >> 4) & 0xF;
-        int hist1 = wave->adpcm_history1_16[cur_channel];
-        int hist2 = wave->adpcm_history2_16[cur_channel];
-        int coef1 = wave->adpcm_coeff[cur_channel][coef_index * 2];
-        int coef2 = wave->adpcm_coeff[cur_channel][coef_index * 2 + 1];
-
-        first_sample = first_sample % 14;
-
-        for (int i = first_sample; i < first_sample + samples_to_do; i++, sample_count += wave->header.channel_count) {
-            if ((i & 1) == 0)
-                sample_byte = reader->ReadByte(); // sample_byte = read_8bit(framesin * 8 + stream->offset + 1 + i / 2, stream->streamfile);
-            // reader->Seek(wave.file_offset + wave.header.start_offset + wave.header.interleave * cur_channel
-            //     + framesin * 8 + 1 + i / 2);
-            // sample_byte = reader->ReadByte();
+    return result;
+}
 
-            int sample = (((
-                         ((i & 1) ? nibble_to_int[sample_byte & 0xF] : nibble_to_int[sample_byte >> 04])
-                         * scale) << 11) + 1024 + (coef1 * hist1 + coef2 * hist2)) >> 11;
+// Frames are compared by their visible pixels row by row, so pitch padding
+// never makes two identical frames differ
+uint64_t     HashSurfacePixels(SDL_Surface* surface) {
+    uint64_t hash = ((uint64_t)surface->w << 32) | (uint32_t)surface->h;
+    for (int y = 0; y < surface->h; y++)
+        hash = (hash ^ HashTextureBytes((uint8_t*)surface->pixels + y * surface->pitch, surface->w * 4)) * 0x100000001B3ULL;
+    return hash;
+}
+bool         SameSurfacePixels(SDL_Surface* a, SDL_Surface* b) {
+    if (a->w != b->w || a->h != b->h)
+        return false;
+    for (int y = 0; y < a->h; y++) {
+        if (memcmp((uint8_t*)a->pixels + y * a->pitch, (uint8_t*)b->pixels + y * b->pitch, a->w * 4))
+            return false;
+    }
+    return true;
+}
 
-            if (sample > 32767) sample = 32767;
-            if (sample < -32768) sample = -32768;
+// DSP-ADPCM: 8-byte frames of a header byte (scale exponent in the low
+// nibble, coefficient pair in the high one) and 14 signed 4-bit samples,
+// high nibble first
+static const int AdpcmNibbles[16] = { 0, 1, 2, 3, 4, 5, 6, 7, -8, -7, -6, -5, -4, -3, -2, -1 };
 
-            wave->samples[sample_count + cur_channel] = (int16_t)sample;
+static inline int16_t ClampSample(int sample) {
+    return (int16_t)(sample < -32768 ? -32768 : (sample > 32767 ? 32767 : sample));
+}
+static void  DecodeADPCMFrames(int16_t* out, const uint8_t* data, size_t frameCount, const int* coeffs, int* history1, int* history2) {
+    int hist1 = *history1;
+    int hist2 = *history2;
+    for (size_t f = 0; f < frameCount; f++, data += 8) {
+        // Scaled up front by the 2^11 the coefficients carry
+        int scale = (1 << (data[0] & 0xF)) * 2048;
+        int coef1 = coeffs[(data[0] >> 4 & 7) * 2];
+        int coef2 = coeffs[(data[0] >> 4 & 7) * 2 + 1];
+
+        for (int i = 1; i < 8; i++) {
+            int sample = (AdpcmNibbles[data[i] >> 4] * scale + 1024 + coef1 * hist1 + coef2 * hist2) >> 11;
+            hist2 = hist1;
+            hist1 = *out++ = ClampSample(sample);
 
+            sample = (AdpcmNibbles[data[i] & 0xF] * scale + 1024 + coef1 * hist1 + coef2 * hist2) >> 11;
             hist2 = hist1;
-            hist1 = (int16_t)sample;
+            hist1 = *out++ = ClampSample(sample);
         }
-
-        wave->adpcm_history1_16[cur_channel] = hist1;
-        wave->adpcm_history2_16[cur_channel] = hist2;
     }
+    *history1 = hist1;
+    *history2 = hist2;
+}
+// Reads the frames of one channel, which are stored back to back from its
+// offset, in one go
+uint8_t*     ReadADPCMChannel(wave_t* wave, Stream* reader, int cur_channel, size_t frameCount) {
+    uint8_t* data = (uint8_t*)calloc(frameCount ? frameCount : 1, 8);
+    if (data)
+        reader->ReadAt(wave->file_offset + wave->header.start_offset + wave->header.interleave * cur_channel, data, frameCount * 8);
+    return data;
 }
 
 bool         printReadInfo = false;
 const char*  weirdChamp = NULL;
+int          threadCount = 1;
+// Reads a NUL-terminated string into the arena, like Stream::ReadUntil
+char*        ReadArenaString(Stream* reader, Arena* arena) {
+    // Fast path: the whole string is already in the read window
+    if (reader->ReadCursor < reader->ReadEnd) {
+        uint8_t* end = (uint8_t*)memchr(reader->ReadCursor, 0, reader->ReadEnd - reader->ReadCursor);
+        if (end) {
+            size_t size = end - reader->ReadCursor + 1;
+            char* string = (char*)arena->Alloc(size);
+            memcpy(string, reader->ReadCursor, size);
+            reader->ReadCursor = end + 1;
+            return string;
+        }
+    }
+
+    size_t start = reader->Position();
+    size_t length = reader->Length();
+    bool terminated = false;
+    while (reader->Position() < length) {
+        if (!reader->ReadByte()) {
+            terminated = true;
+            break;
+        }
+    }
+
+    size_t end = reader->Position();
+    size_t size = end - start - (terminated ? 1 : 0);
+
+    char* string = (char*)arena->Alloc(size + 1);
+    reader->Seek(start);
+    reader->ReadBytes(string, (int)size);
+    string[size] = 0;
+    reader->Seek(end);
+    return string;
+}
+
 // Sub Types
-void         ReadFrame(frame_t* frame, uint64_t file_offset, FileStream* reader) {
+void         ReadFrame(frame_t* frame, uint64_t file_offset, Stream* reader, Arena* arena) {
     reader->Seek(file_offset);
     reader->ReadBytes(frame, sizeof(frame_t) - sizeof(frame_piece_t*));
 
@@ -501,11 +1046,11 @@ void         ReadFrame(frame_t* frame, uint64_t file_offset, FileStream* reader)
     }
 
     if (frame->piece_count != 0) {
-        frame->pieces = (frame_piece_t*)malloc(frame->piece_count * sizeof(frame_piece_t));
-        for (int d = 0; d < frame->piece_count; d++) {
-            frame_piece_t frame_piece;
-            reader->ReadBytes(&frame_piece, sizeof(frame_piece));
-            frame->pieces[d] = frame_piece;
+        frame->pieces = (frame_piece_t*)arena->Alloc(frame->piece_count * sizeof(frame_piece_t));
+        reader->ReadBytes(frame->pieces, frame->piece_count * sizeof(frame_piece_t));
+
+        for (int d = 0; d < frame->piece_count && printReadInfo; d++) {
+            frame_piece_t frame_piece = frame->pieces[d];
 
             if (printReadInfo)
                 printf("Piece Info: Texture ID %-4d\n    DST (%d,%d) (%d,%d) (%d,%d) (%d,%d)\n    SRC (%d,%d) (%d,%d) (%d,%d) (%d,%d)\n",
@@ -530,7 +1075,7 @@ void         ReadFrame(frame_t* frame, uint64_t file_offset, FileStream* reader)
     }
     else {
         frame->piece_count = 1;
-        frame->pieces = (frame_piece_t*)calloc(frame->piece_count, sizeof(frame_piece_t));
+        frame->pieces = (frame_piece_t*)arena->Calloc(frame->piece_count, sizeof(frame_piece_t));
         for (int d = 0; d < frame->piece_count; d++) {
             frame_piece_t frame_piece;
             reader->ReadBytes(&frame_piece, sizeof(frame_piece));
@@ -586,17 +1131,23 @@ void         ReadFrame(frame_t* frame, uint64_t file_offset, FileStream* reader)
     if (printReadInfo)
         printf("\n");
 }
-void         ReadTextureEntry(uint64_t file_offset, FileStream* reader) {
+void         ReadTextureEntry(uint64_t file_offset, Stream* reader) {
 
 }
 
 // Main Types
-vol_t        ReadVOL(FileStream* reader) {
+vol_t        ReadVOL(Stream* reader) {
     vol_t vol;
-    vol.fileMap = new HashMap<vol_file_t*>(NULL, 4);
+    vol.index = NULL;
     vol.file_offset = reader->Position();
 
     reader->ReadBytes(&vol.header, sizeof(vol.header));
+
+    // Size the map up front so it never resizes while filling
+    int capacity = 4;
+    while ((uint32_t)capacity <= vol.header.file_count * 2)
+        capacity <<= 1;
+    vol.fileMap = new HashMap<vol_file_t*>(NULL, capacity);
     // vol.unknown_hash_count = reader->ReadUInt32();
     // for (int i = 0; i < vol.unknown_hash_count; i++) {
     //     vol.unknown_hashes.push_back(reader->ReadUInt32());
@@ -623,9 +1174,10 @@ vol_t        ReadVOL(FileStream* reader) {
     reader->ReadUInt32(); // Unknown hash?
 
     vol.files = (vol_file_t*)malloc(sizeof(vol_file_t) * vol.header.file_count);
-    for (uint32_t i = 0; i < vol.header.file_count; i++) {
-        reader->ReadBytes(&vol.files[i], 0x14);
+    reader->ReadBytes(vol.files, sizeof(vol_file_t) * vol.header.file_count);
+    vol.fileStrings.reserve(vol.header.file_count);
 
+    for (uint32_t i = 0; i < vol.header.file_count; i++) {
         vol_file_t file = vol.files[i];
 
         char* str;
@@ -650,7 +1202,213 @@ vol_t        ReadVOL(FileStream* reader) {
     }
     return vol;
 }
-wave_t       ReadWAVE(FileStream* reader) {
+#define VOL_INDEX_MAGIC   0x58444956U
+#define VOL_INDEX_VERSION 1
+
+bool         useVOLIndex = true;
+
+bool         GetVOLIndexKey(const char* in_filename, uint64_t* size, int64_t* mtime) {
+    struct stat st;
+    if (stat(in_filename, &st) != 0)
+        return false;
+
+    *size = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return true;
+}
+bool         ReadVOLIndex(vol_t* vol, const char* in_filename, Stream* reader) {
+    uint64_t vol_size;
+    int64_t vol_mtime;
+    if (!GetVOLIndexKey(in_filename, &vol_size, &vol_mtime))
+        return false;
+
+    vol_header_t vol_header;
+    size_t file_offset = reader->Position();
+    if (reader->ReadBytes(&vol_header, sizeof(vol_header)) != sizeof(vol_header))
+        return false;
+    reader->Seek(file_offset);
+
+    char index_filename[512];
+    snprintf(index_filename, sizeof(index_filename), "%s.idx", in_filename);
+
+    MappedStream* index = MappedStream::New(index_filename);
+    if (!index)
+        return false;
+
+    vol_index_header_t* header = (vol_index_header_t*)index->data;
+    if (index->size < sizeof(vol_index_header_t)
+        || header->magic != VOL_INDEX_MAGIC
+        || header->version != VOL_INDEX_VERSION
+        || header->vol_size != vol_size
+        || header->vol_mtime != vol_mtime
+        || header->file_offset != file_offset
+        || memcmp(&header->vol_header, &vol_header, sizeof(vol_header))
+        || header->file_count != vol_header.file_count
+        || header->map_capacity <= header->file_count // The map is kept under half full
+        || (header->map_capacity & (header->map_capacity - 1))
+        || header->files_offset + (uint64_t)header->file_count * sizeof(vol_file_t) > index->size
+        || header->name_offsets_offset + (uint64_t)header->file_count * sizeof(uint32_t) > index->size
+        || header->names_offset + (uint64_t)header->names_size > index->size
+        || header->map_offset + (uint64_t)header->map_capacity * sizeof(vol_index_slot_t) > index->size) {
+        index->Close();
+        return false;
+    }
+
+    // Every name has to start inside the names blob, and the blob has to
+    // end in a NUL so none of them runs off its end
+    char* names = (char*)(index->data + header->names_offset);
+    uint32_t* name_offsets = (uint32_t*)(index->data + header->name_offsets_offset);
+    bool namesValid = header->file_count == 0
+        || (header->names_size > 0 && names[header->names_size - 1] == 0);
+    for (uint32_t i = 0; i < header->file_count && namesValid; i++) {
+        if (name_offsets[i] >= header->names_size)
+            namesValid = false;
+    }
+    if (!namesValid) {
+        index->Close();
+        return false;
+    }
+
+    vol->index = index;
+    vol->file_offset = header->file_offset;
+    vol->header = header->vol_header;
+    vol->files = (vol_file_t*)(index->data + header->files_offset);
+
+    vol->fileStrings.clear();
+    vol->fileStrings.reserve(header->file_count);
+    for (uint32_t i = 0; i < header->file_count; i++) {
+        vol->fileStrings.push_back(names + name_offsets[i]);
+    }
+
+    vol_index_slot_t* slots = (vol_index_slot_t*)(index->data + header->map_offset);
+    vol->fileMap = new HashMap<vol_file_t*>(NULL, header->map_capacity);
+    for (uint32_t i = 0; i < header->map_capacity; i++) {
+        if (slots[i].file_index < header->file_count)
+            vol->fileMap->SetSlot(i, slots[i].key, &vol->files[slots[i].file_index]);
+    }
+    return true;
+}
+void         WriteVOLIndex(vol_t* vol, const char* in_filename) {
+    vol_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    if (!GetVOLIndexKey(in_filename, &header.vol_size, &header.vol_mtime))
+        return;
+
+    uint32_t file_count = vol->header.file_count;
+
+    vector<uint32_t> name_offsets;
+    uint32_t names_size = 0;
+    for (uint32_t i = 0; i < file_count; i++) {
+        name_offsets.push_back(names_size);
+        names_size += strlen(vol->fileStrings[i]) + 1;
+    }
+
+    header.magic = VOL_INDEX_MAGIC;
+    header.version = VOL_INDEX_VERSION;
+    header.vol_header = vol->header;
+    header.file_offset = vol->file_offset;
+    header.file_count = file_count;
+    header.files_offset = sizeof(header);
+    header.name_offsets_offset = header.files_offset + file_count * sizeof(vol_file_t);
+    header.map_offset = header.name_offsets_offset + file_count * sizeof(uint32_t);
+    header.map_capacity = vol->fileMap->Capacity;
+    header.names_offset = header.map_offset + header.map_capacity * sizeof(vol_index_slot_t);
+    header.names_size = names_size;
+
+    char index_filename[512];
+    char temp_filename[520];
+    snprintf(index_filename, sizeof(index_filename), "%s.idx", in_filename);
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", index_filename);
+
+    FileStream* writer = FileStream::New(temp_filename, FileStream::WRITE_ACCESS);
+    if (!writer) return;
+
+    writer->WriteBytes(&header, sizeof(header));
+    writer->WriteBytes(vol->files, file_count * sizeof(vol_file_t));
+    writer->WriteBytes(name_offsets.data(), file_count * sizeof(uint32_t));
+    for (int i = 0; i < vol->fileMap->Capacity; i++) {
+        vol_index_slot_t slot = { 0, 0xFFFFFFFFU };
+        if (vol->fileMap->Data[i].Used) {
+            slot.key = vol->fileMap->Data[i].Key;
+            slot.file_index = vol->fileMap->Data[i].Data - vol->files;
+        }
+        writer->WriteBytes(&slot, sizeof(slot));
+    }
+    for (uint32_t i = 0; i < file_count; i++) {
+        writer->WriteBytes(vol->fileStrings[i], strlen(vol->fileStrings[i]) + 1);
+    }
+    writer->Close();
+
+    remove(index_filename);
+    rename(temp_filename, index_filename);
+}
+void         FreeVOL(vol_t* vol) {
+    if (vol->index) {
+        vol->index->Close();
+    }
+    else {
+        for (size_t i = 0; i < vol->fileStrings.size(); i++) {
+            free(vol->fileStrings[i]);
+        }
+        free(vol->files);
+    }
+    vol->fileStrings.clear();
+    delete vol->fileMap;
+}
+// Tracks with at least this many samples can decode their channels in parallel
+#define ADPCM_PARALLEL_SAMPLES 0x40000
+// Threads decoding the channels of each such track (like --sheet-threads,
+// off by default so -j and pipeline workers don't each start more)
+int          waveThreads = 1;
+
+void         DecodeWAVE(wave_t* wave, Stream* reader) {
+    int channels = wave->header.channel_count;
+    size_t sampleCount = wave->header.sample_count;
+    wave->samples = (uint16_t*)calloc(sampleCount ? sampleCount : 1, channels * sizeof(uint16_t));
+    if (!wave->samples || !channels)
+        return;
+
+    // Only whole frames are decoded, and never the final one; the samples
+    // it would have covered stay silent
+    size_t frameCount = sampleCount ? (sampleCount - 1) / 14 : 0;
+
+    // The reader is only used here, so the channels can then be decoded on
+    // separate threads, each into its own plane
+    vector<uint8_t*> channelData(channels);
+    vector<int16_t*> planes(channels, NULL);
+    for (int c = 0; c < channels; c++) {
+        channelData[c] = ReadADPCMChannel(wave, reader, c, frameCount);
+        if (channels == 1)
+            planes[c] = (int16_t*)wave->samples;
+        else
+            planes[c] = (int16_t*)malloc(frameCount * 14 * sizeof(int16_t) + 1);
+    }
+
+    ThreadPool::ParallelFor(sampleCount >= ADPCM_PARALLEL_SAMPLES ? std::min(waveThreads, channels) : 1, channels, [&](size_t c) {
+        if (channelData[c] && planes[c])
+            DecodeADPCMFrames(planes[c], channelData[c], frameCount, wave->adpcm_coeff[c], &wave->adpcm_history1_16[c], &wave->adpcm_history2_16[c]);
+    });
+
+    if (channels > 1) {
+        int16_t* samples = (int16_t*)wave->samples;
+        for (int c = 0; c < channels; c++) {
+            if (!channelData[c] || !planes[c])
+                continue;
+            for (size_t i = 0; i < frameCount * 14; i++)
+                samples[i * channels + c] = planes[c][i];
+        }
+    }
+
+    for (int c = 0; c < channels; c++) {
+        free(channelData[c]);
+        if (channels > 1)
+            free(planes[c]);
+    }
+}
+// Read* parse the headers and tables. ReadWAVE with decode set also decodes
+// the samples; ANIM and IMAGE textures are decoded on first use, from reader,
+// which has to stay open until the entry is extracted.
+wave_t       ReadWAVE(Stream* reader, bool decode = true) {
     wave_t wave;
 
     wave.file_offset = reader->Position();
@@ -713,16 +1471,13 @@ wave_t       ReadWAVE(FileStream* reader) {
         }
     }
 
-    wave.samples = (uint16_t*)calloc(wave.header.sample_count, wave.header.channel_count * sizeof(uint16_t));
-
-    for (int c = 0; c < wave.header.channel_count; c++) {
-        ReadADPCMChannel(&wave, reader, c);
-    }
-
+    wave.samples = NULL;
+    if (decode)
+        DecodeWAVE(&wave, reader);
 
     return wave;
 }
-anim_t       ReadANIM(FileStream* reader) {
+anim_t       ReadANIM(Stream* reader, Arena* arena) {
     anim_t anim;
 
     anim.file_offset = reader->Position();
@@ -756,21 +1511,27 @@ anim_t       ReadANIM(FileStream* reader) {
 
     char* str;
     uint64_t dis;
-    for (int i = 0; i < anim.header.anim_entry_count; i++) {
-        anim_entry_t ae;
-        reader->ReadBytes(&ae, 0x14);
 
-        anim.entries.push_back(ae);
+    // The entry table is 0x14-byte records; anim_entry_t adds the frame_data pointer
+    uint8_t* entryTable = (uint8_t*)malloc(anim.header.anim_entry_count * 0x14 + 1);
+    reader->ReadBytes(entryTable, anim.header.anim_entry_count * 0x14);
+
+    anim.entries.resize(anim.header.anim_entry_count);
+    anim.entryNames.reserve(anim.header.anim_entry_count);
+    for (int i = 0; i < anim.header.anim_entry_count; i++) {
+        memcpy(&anim.entries[i], entryTable + i * 0x14, 0x14);
+        anim.entries[i].frame_data = NULL;
     }
+    free(entryTable);
 
     // Get the frame data
     for (int i = 0; i < anim.header.anim_entry_count; i++) {
         anim_entry_t* ae = &anim.entries[i];
-        ae->frame_data = (frame_data_t*)calloc(ae->frame_count, sizeof(frame_data_t));
+        ae->frame_data = (frame_data_t*)arena->Calloc(ae->frame_count, sizeof(frame_data_t));
 
         dis = reader->Position();
         reader->Seek(anim.file_offset + ae->offset_to_string);
-        str = reader->ReadString();
+        str = ReadArenaString(reader, arena);
         reader->Seek(dis);
 
         anim.entryNames.push_back(str);
@@ -784,8 +1545,8 @@ anim_t       ReadANIM(FileStream* reader) {
             printf("%-20s %d\n", "Frame Count:", ae->frame_count);
             printf("%-20s 0x%X\n", "Frame Data Offset:", ae->frame_data_offset);
         }
-        for (uint32_t f = 0; f < ae->frame_count; f++) {
-            reader->ReadBytes(&ae->frame_data[f], sizeof(frame_data_t));
+        reader->ReadBytes(ae->frame_data, ae->frame_count * sizeof(frame_data_t));
+        for (uint32_t f = 0; f < ae->frame_count && printReadInfo; f++) {
             if (printReadInfo)
                 printf("Info: ID %2d, X %4d, Y %4d\n",
                     ae->frame_data[f].frame_id,
@@ -803,16 +1564,15 @@ anim_t       ReadANIM(FileStream* reader) {
         printf("========================\n\n");
     }
 
-    vector<uint32_t> frame_offsets;
+    vector<uint32_t> frame_offsets(anim.header.frame_count);
     reader->Seek(anim.file_offset + anim.header.frame_list_offset);
-    for (int i = 0; i < anim.header.frame_count; i++) {
-        frame_offsets.push_back(reader->ReadUInt32());
-    }
+    reader->ReadBytes(frame_offsets.data(), anim.header.frame_count * sizeof(uint32_t));
 
+    anim.frames.resize(anim.header.frame_count);
+    anim.framePlans.resize(anim.header.frame_count);
     for (int i = 0; i < anim.header.frame_count; i++) {
-        frame_t frame;
-        ReadFrame(&frame, anim.file_offset + frame_offsets[i], reader);
-        anim.frames.push_back(frame);
+        ReadFrame(&anim.frames[i], anim.file_offset + frame_offsets[i], reader, arena);
+        anim.framePlans[i] = BuildBlitPlan(&anim.frames[i], arena);
     }
 
     reader->Seek(anim.file_offset + anim.header.texture_entries_header_offset);
@@ -828,10 +1588,11 @@ anim_t       ReadANIM(FileStream* reader) {
         printf("========================\n\n");
     }
 
-    for (uint32_t i = 0; i < anim.texture_entries_header.texture_count; i++) {
-        texture_entry_t entry;
-        reader->ReadBytes(&entry, sizeof(entry));
-        anim.textures.push_back(entry);
+    anim.textures.resize(anim.texture_entries_header.texture_count);
+    reader->ReadBytes(anim.textures.data(), anim.texture_entries_header.texture_count * sizeof(texture_entry_t));
+
+    for (uint32_t i = 0; i < anim.texture_entries_header.texture_count && printReadInfo; i++) {
+        texture_entry_t entry = anim.textures[i];
 
         if (printReadInfo) {
             printf("Size Factor: %2d, ", entry.size_factor);
@@ -846,13 +1607,12 @@ anim_t       ReadANIM(FileStream* reader) {
         }
     }
 
-    for (uint32_t i = 0; i < anim.texture_entries_header.texture_count; i++) {
-        anim.textureSurfaces.push_back(GetPixelsFromTextureEntry(anim.textures[i], anim.file_offset + anim.header.texture_entries_header_offset, reader));
-    }
+    anim.textureSurfaces.assign(anim.texture_entries_header.texture_count, NULL);
+    anim.textureReader = reader;
 
     return anim;
 }
-image_t      ReadIMAGE(FileStream* reader) {
+image_t      ReadIMAGE(Stream* reader, Arena* arena) {
     image_t image;
     image.file_offset = reader->Position();
     reader->ReadBytes(&image.header, sizeof(image.header));
@@ -877,7 +1637,8 @@ image_t      ReadIMAGE(FileStream* reader) {
     }
 
     reader->Seek(image.file_offset + image.header.frame_offset);
-    ReadFrame(&image.frame, image.file_offset + image.header.frame_offset, reader);
+    ReadFrame(&image.frame, image.file_offset + image.header.frame_offset, reader, arena);
+    image.framePlan = BuildBlitPlan(&image.frame, arena);
 
     reader->Seek(image.file_offset + image.header.texture_entries_header_offset);
     reader->ReadBytes(&image.texture_entries_header, sizeof(texture_entries_header_t));
@@ -891,10 +1652,11 @@ image_t      ReadIMAGE(FileStream* reader) {
         printf("========================\n\n");
     }
 
-    for (uint32_t i = 0; i < image.texture_entries_header.texture_count; i++) {
-        texture_entry_t entry;
-        reader->ReadBytes(&entry, sizeof(entry));
-        image.textures.push_back(entry);
+    image.textures.resize(image.texture_entries_header.texture_count);
+    reader->ReadBytes(image.textures.data(), image.texture_entries_header.texture_count * sizeof(texture_entry_t));
+
+    for (uint32_t i = 0; i < image.texture_entries_header.texture_count && printReadInfo; i++) {
+        texture_entry_t entry = image.textures[i];
 
         if (printReadInfo) {
             printf("Size Factor: %2d, ", entry.size_factor);
@@ -909,78 +1671,397 @@ image_t      ReadIMAGE(FileStream* reader) {
         }
     }
 
-    for (uint32_t i = 0; i < image.texture_entries_header.texture_count; i++) {
-        image.textureSurfaces.push_back(GetPixelsFromTextureEntry(image.textures[i], image.file_offset + image.header.texture_entries_header_offset, reader));
-    }
+    image.textureSurfaces.assign(image.texture_entries_header.texture_count, NULL);
+    image.textureReader = reader;
 
     return image;
 }
 
 // Extracting
-void         ExtractIMAGE(image_t image, const char* filename, bool freeSurfs) {
-    if (image.textureSurfaces.size() > 0) {
-        SDL_Surface* result = GetSurfaceFromFrame(&image.textureSurfaces, image.frame);
+#define EXTRACTOR_VERSION "3"
 
-        IMG_SavePNG(result, filename);
-        SDL_FreeSurface(result);
+// EXTRACTOR_VERSION plus the options that change what gets written, so a
+// run with different ones re-extracts everything
+char         extractorVersion[32] = EXTRACTOR_VERSION;
+
+// A finished output file, encoded in memory
+struct output_file_t {
+    char*    filename;
+    uint8_t* data;
+    size_t   size;
+};
+// What the manifest keeps about a written output
+struct manifest_output_t {
+    char*    filename;
+    uint64_t size;
+    uint64_t hash;
+};
+
+// Files written for the entry being extracted on this thread (for the manifest)
+thread_local vector<manifest_output_t>* entryOutputs = NULL;
+// When set, outputs made on this thread are collected here instead of written
+thread_local vector<output_file_t>*     pendingOutputs = NULL;
+
+uint64_t     HashBytes(const uint8_t* data, size_t size) {
+    // FNV-1a, 64-bit
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
     }
+    return hash;
+}
+void         RecordOutput(const char* filename, uint8_t* data, size_t size) {
+    if (!entryOutputs)
+        return;
+
+    manifest_output_t output;
+    output.filename = strdup(filename);
+    output.size = size;
+    output.hash = HashBytes(data, size);
+    entryOutputs->push_back(output);
+}
+// Output files are handed to this writer, which owns them from then on
+OutputWriter* outputWriter = NULL;
+int          writerThreads = 2;
+bool         syncOutputs = false;
+// When set, outputs go into this tar archive ("-" for stdout) instead of files
+const char*  tarFilename = NULL;
+
+TarWriter*   OpenTarOutput(const char* filename, int64_t mtime) {
+    FileStream* stream;
+    if (!strcmp(filename, "-"))
+        stream = FileStream::New(Stdout_Detach());
+    else
+        stream = FileStream::New(filename, FileStream::WRITE_ACCESS);
+    if (!stream) {
+        printf("Could not open \"%s\" for writing\n", filename);
+        return NULL;
+    }
+
+    TarWriter* tar = TarWriter::New(stream, mtime);
+    if (!tar)
+        stream->Close();
+    return tar;
+}
+
+void         WriteOutputFile(output_file_t* output) {
+    RecordOutput(output->filename, output->data, output->size);
+    outputWriter->Write(output->filename, output->data, output->size);
+}
+void         WriteOutputFiles(vector<output_file_t>* outputs) {
+    for (size_t o = 0; o < outputs->size(); o++)
+        WriteOutputFile(&(*outputs)[o]);
+    outputs->clear();
+}
+// A tar archive lists files in the order they reach the writer, so when
+// entries finish out of order their outputs are held and handed over in
+// schedule order to keep the archive the same from run to run
+bool         OrderOutputs() {
+    return outputWriter->Tar != NULL;
+}
+// Hands a finished file over to be written. Takes ownership of data.
+void         WriteOutput(const char* filename, uint8_t* data, size_t size) {
+    output_file_t output;
+    output.filename = strdup(filename);
+    output.data = data;
+    output.size = size;
+
+    if (pendingOutputs) {
+        pendingOutputs->push_back(output);
+        return;
+    }
+    WriteOutputFile(&output);
+}
+void         WriteOutput(const char* filename, MemoryStream* stream) {
+    stream->owned = false;
+    WriteOutput(filename, stream->data, stream->size);
+    stream->Close();
+}
+
+// Format of IMAGE output and ANIM sheets
+enum {
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_QOI,
+    IMAGE_FORMAT_RAW,
+};
+int          imageFormat = IMAGE_FORMAT_PNG;
+const char*  imageExtensions[] = { "png", "qoi", "rgba" };
+
+// Compression level for PNG output (0 stores) and threads per image
+int          pngLevel = 6;
+int          pngThreads = 1;
+
+// Raw output: this header, then the pixels as RGBA8888 rows, top to bottom
+// and unpadded, starting 16 bytes in so they can be mapped straight from the
+// file. Numbers are little endian.
+struct raw_image_header_t {
+    char     magic[4]; // "RGBA"
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_offset;
+};
 
-    if (freeSurfs) {
-        for (size_t t = 0; t < image.textureSurfaces.size(); t++) {
-            SDL_FreeSurface(image.textureSurfaces[t]);
+bool         WriteRawImage(Stream* stream, SDL_Surface* surface) {
+    raw_image_header_t header;
+    memcpy(header.magic, "RGBA", 4);
+    stream->WriteBytes(header.magic, 4);
+    stream->WriteUInt32(surface->w);
+    stream->WriteUInt32(surface->h);
+    stream->WriteUInt32(sizeof(header));
+
+    size_t length = (size_t)surface->w * 4;
+    for (int y = 0; y < surface->h; y++) {
+        if (stream->WriteBytes((uint8_t*)surface->pixels + y * surface->pitch, (int)length) != length)
+            return false;
+    }
+    return true;
+}
+// Encodes a composited RGBA32 surface in the selected format (whose bytes
+// are already in the order every format wants) and writes it out
+void         SaveImage(SDL_Surface* surface, const char* filename) {
+    MemoryStream* stream;
+    if (imageFormat == IMAGE_FORMAT_RAW)
+        stream = MemoryStream::New(sizeof(raw_image_header_t) + (size_t)surface->w * surface->h * 4);
+    else
+        stream = MemoryStream::New((size_t)0);
+    if (!stream)
+        return;
+
+    bool encoded = false;
+    switch (imageFormat) {
+        case IMAGE_FORMAT_PNG:
+            encoded = PNGWriter::Write(stream, (uint8_t*)surface->pixels, surface->w, surface->h, surface->pitch, pngLevel, pngThreads);
+            break;
+        case IMAGE_FORMAT_QOI:
+            encoded = QOIWriter::Write(stream, (uint8_t*)surface->pixels, surface->w, surface->h, surface->pitch);
+            break;
+        case IMAGE_FORMAT_RAW:
+            encoded = WriteRawImage(stream, surface);
+            break;
+    }
+
+    if (!encoded) {
+        printf("Could not encode \"%s\"\n", filename);
+        stream->Close();
+        return;
+    }
+    WriteOutput(filename, stream);
+}
+texture_set_t GetIMAGETextures(image_t* image) {
+    texture_set_t textures;
+    textures.entries = &image->textures;
+    textures.surfaces = &image->textureSurfaces;
+    textures.file_offset = image->file_offset + image->header.texture_entries_header_offset;
+    textures.reader = image->textureReader;
+    return textures;
+}
+texture_set_t GetANIMTextures(anim_t* anim) {
+    texture_set_t textures;
+    textures.entries = &anim->textures;
+    textures.surfaces = &anim->textureSurfaces;
+    textures.file_offset = anim->file_offset + anim->header.texture_entries_header_offset;
+    textures.reader = anim->textureReader;
+    return textures;
+}
+// Decodes every texture the image's frame draws from
+void         DecodeIMAGETextures(image_t* image) {
+    texture_set_t textures = GetIMAGETextures(image);
+    for (int i = 0; i < image->framePlan.count; i++)
+        GetTexture(&textures, image->framePlan.ops[i].texture);
+}
+// Decodes every texture the frames some animation uses draw from, so the
+// frames can then be drawn on several threads without touching the reader
+void         DecodeANIMTextures(anim_t* anim) {
+    texture_set_t textures = GetANIMTextures(anim);
+    vector<bool> decoded(anim->frames.size(), false);
+    for (size_t i = 0; i < anim->entries.size(); i++) {
+        for (Uint32 f = 0; f < anim->entries[i].frame_count; f++) {
+            size_t id = anim->entries[i].frame_data[f].frame_id;
+            if (id >= anim->frames.size() || decoded[id])
+                continue;
+
+            decoded[id] = true;
+            for (int p = 0; p < anim->framePlans[id].count; p++)
+                GetTexture(&textures, anim->framePlans[id].ops[p].texture);
         }
     }
 }
+void         ExtractIMAGE(image_t image, const char* filename, bool freeSurfs) {
+    texture_set_t textures = GetIMAGETextures(&image);
+
+    if (image.textures.size() > 0) {
+        SDL_Surface* result = GetSurfaceFromFrame(&textures, &image.frame, &image.framePlan);
+
+        SaveImage(result, filename);
+        SDL_FreeSurface(result);
+    }
+
+    if (freeSurfs)
+        ReleaseTextures(&textures);
+}
+// Largest width/height of an ANIM sprite sheet; frames spill onto more sheets
+int          sheetSizeLimit = 2048;
+
+// Threads drawing each sprite sheet, in bands of SHEET_BAND_HEIGHT rows
+int          sheetThreads = 1;
+#define SHEET_BAND_HEIGHT 64
+
+// Sheets after the first are numbered: "x.anim.png", "x.anim.1.png", ...
+void         GetSheetFilename(char* sheetFilename, const char* filename, int sheet) {
+    const char* extension = strrchr(filename, '.');
+    if (sheet == 0 || !extension)
+        strcpy(sheetFilename, filename);
+    else
+        sprintf(sheetFilename, "%.*s.%d%s", (int)(extension - filename), filename, sheet, extension);
+}
 void         ExtractANIM(anim_t anim, const char* filename, bool freeSurfs) {
     vector<RSDK_Animation> Animations;
+    int sheetCount = 1;
 
-    if (anim.textureSurfaces.size() > 0) {
-        for (size_t t = 0; t < anim.frames.size(); t++) {
-            anim.frameSurfaces.push_back(GetSurfaceFromFrame(&anim.textureSurfaces, anim.frames[t]));
-        }
+    texture_set_t textures = GetANIMTextures(&anim);
 
-        size_t sheetWidth = 2;  // left/right padding
-        size_t sheetHeight = 2; // top/bottom padding
-        size_t anim_y = 1;
+    if (anim.textures.size() > 0) {
+        // Only frames some animation uses are drawn
+        vector<uint32_t> frameUses(anim.frames.size(), 0);
         for (size_t i = 0; i < anim.entries.size(); i++) {
-            anim_y += 8 + 1;
-
-            if (sheetWidth < 1 + strlen(anim.entryNames[i]) * 8 + 1)
-                sheetWidth = 1 + strlen(anim.entryNames[i]) * 8 + 1;
-
-            size_t startX = 1;
-            size_t maxRowY = 0;
             for (Uint32 f = 0; f < anim.entries[i].frame_count; f++) {
-                frame_data_t fd = anim.entries[i].frame_data[f];
-                SDL_Surface* frame = anim.frameSurfaces[fd.frame_id];
+                if (anim.entries[i].frame_data[f].frame_id < anim.frames.size())
+                    frameUses[anim.entries[i].frame_data[f].frame_id]++;
+            }
+        }
 
-                if (f > 0 && startX + frame->w > 1024) {
-                    startX = 1;
-                    anim_y += maxRowY + 1;
-                    maxRowY = 0;
+        // DecodeANIMTextures has decoded everything the used frames draw from
+        textures.readOnly = true;
+
+        // Hash the pixels of every used frame, then walk the frames in the
+        // order the animations first use them. A frame whose pixels match an
+        // earlier one shares that frame's rect on the sheet; a hash match is
+        // confirmed by drawing both frames again.
+        vector<uint64_t> frameHashes(anim.frames.size(), 0);
+        ThreadPool::ParallelFor(sheetThreads, anim.frames.size(), [&](size_t id) {
+            if (!frameUses[id])
+                return;
+            SDL_Surface* frame = GetSurfaceFromFrame(&textures, &anim.frames[id], &anim.framePlans[id]);
+            frameHashes[id] = HashSurfacePixels(frame);
+            SDL_FreeSurface(frame);
+        });
+
+        vector<size_t> canonical(anim.frames.size(), SIZE_MAX);
+        vector<size_t> order;
+        std::unordered_map<uint64_t, vector<size_t>> framesByHash;
+        for (size_t i = 0; i < anim.entries.size(); i++) {
+            for (Uint32 f = 0; f < anim.entries[i].frame_count; f++) {
+                size_t id = anim.entries[i].frame_data[f].frame_id;
+                if (id >= anim.frames.size() || canonical[id] != SIZE_MAX)
+                    continue;
+
+                canonical[id] = id;
+                vector<size_t>& matches = framesByHash[frameHashes[id]];
+                if (matches.size()) {
+                    SDL_Surface* frame = GetSurfaceFromFrame(&textures, &anim.frames[id], &anim.framePlans[id]);
+                    for (size_t m = 0; m < matches.size(); m++) {
+                        SDL_Surface* match = GetSurfaceFromFrame(&textures, &anim.frames[matches[m]], &anim.framePlans[matches[m]]);
+                        bool same = SameSurfacePixels(match, frame);
+                        SDL_FreeSurface(match);
+                        if (same) {
+                            canonical[id] = matches[m];
+                            break;
+                        }
+                    }
+                    SDL_FreeSurface(frame);
                 }
 
-                if (maxRowY < (size_t)frame->h)
-                    maxRowY = (size_t)frame->h;
+                if (canonical[id] == id) {
+                    matches.push_back(id);
+                    order.push_back(id);
+                }
+            }
+        }
 
-                if (sheetWidth < startX + frame->w + 1)
-                    sheetWidth = startX + frame->w + 1;
-                if (sheetHeight < anim_y + frame->h + 1)
-                    sheetHeight = anim_y + frame->h + 1;
+        // Pack the distinct frames tallest first, each with a pixel of
+        // padding on its right and bottom (the sheet gets the same on its
+        // left and top). A frame goes on the first sheet with room for it;
+        // one bigger than a whole sheet gets a sheet of its own size.
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            frame_t* frameA = &anim.frames[a];
+            frame_t* frameB = &anim.frames[b];
+            if (frameA->height != frameB->height)
+                return frameA->height > frameB->height;
+            return frameA->width > frameB->width;
+        });
+
+        vector<SDL_Rect> frameRects(anim.frames.size());
+        vector<int> frameSheets(anim.frames.size(), 0);
+        vector<SkylinePacker*> packers;
+        vector<vector<size_t>> sheetFrames;
+        bool packed = true;
+        for (size_t o = 0; o < order.size(); o++) {
+            size_t id = order[o];
+            int w = anim.frames[id].width + 1;
+            int h = anim.frames[id].height + 1;
+
+            int x, y;
+            size_t s = 0;
+            for (; s < packers.size(); s++) {
+                if (packers[s]->Insert(w, h, &x, &y))
+                    break;
+            }
+            if (s == packers.size()) {
+                SkylinePacker* packer = SkylinePacker::New(std::max(sheetSizeLimit - 1, w), std::max(sheetSizeLimit - 1, h));
+                if (!packer || !packer->Insert(w, h, &x, &y)) {
+                    if (packer)
+                        packer->Close();
+                    packed = false;
+                    break;
+                }
+                packers.push_back(packer);
+                sheetFrames.push_back(vector<size_t>());
+            }
 
-                startX += frame->w + 1;
+            frameRects[id] = {
+                x + 1, y + 1,
+                w - 1, h - 1,
+            };
+            frameSheets[id] = (int)s;
+            sheetFrames[s].push_back(id);
+        }
+        if (!packed) {
+            // Every frame needs a rect, so there's no partial sheet to write
+            printf("Could not pack frames for \"%s\"\n", filename);
+            for (size_t s = 0; s < packers.size(); s++)
+                packers[s]->Close();
+            if (freeSurfs)
+                ReleaseTextures(&textures);
+            return;
+        }
+        if (packers.size())
+            sheetCount = (int)packers.size();
+
+        // The frame each texture is last drawn in decides the sheet it's
+        // released after. Textures only duplicate frames use aren't drawn
+        // again, so they go now.
+        vector<vector<size_t>> sheetReleases(packers.size());
+        if (freeSurfs) {
+            vector<int> lastSheets(anim.textures.size(), -1);
+            for (size_t s = 0; s < sheetFrames.size(); s++) {
+                for (size_t o = 0; o < sheetFrames[s].size(); o++) {
+                    blit_plan_t* plan = &anim.framePlans[sheetFrames[s][o]];
+                    for (int i = 0; i < plan->count; i++) {
+                        if (plan->ops[i].texture < lastSheets.size())
+                            lastSheets[plan->ops[i].texture] = (int)s;
+                    }
+                }
+            }
+            for (size_t t = 0; t < lastSheets.size(); t++) {
+                if (lastSheets[t] < 0)
+                    ReleaseTexture(&textures, t);
+                else
+                    sheetReleases[lastSheets[t]].push_back(t);
             }
-            anim_y += maxRowY + 1;
         }
 
-        SDL_Surface* result = SDL_CreateRGBSurfaceWithFormat(0, sheetWidth, sheetHeight, 32, SDL_PIXELFORMAT_RGBA32);
-        SDL_FillRect(result, NULL, SDL_MapRGB(result->format, 0x22, 0x22, 0x22));
-
-        anim_y = 1;
         for (size_t i = 0; i < anim.entries.size(); i++) {
-            BlitText(result, anim.entryNames[i], 1, anim_y, SDL_MapRGB(result->format, 0xF2, 0xD1, 0x41));
-
-
             RSDK_Animation an;
             an.Name = anim.entryNames[i];
             an.AnimationSpeed = 0x100;
@@ -988,84 +2069,101 @@ void         ExtractANIM(anim_t anim, const char* filename, bool freeSurfs) {
             an.Flags = 0;
             Animations.push_back(an);
 
-            anim_y += 8 + 1;
-            size_t startX = 1;
-            size_t maxRowY = 0;
             for (Uint32 f = 0; f < anim.entries[i].frame_count; f++) {
-                frame_data_t fd = anim.entries[i].frame_data[f];
-                SDL_Surface* frame = anim.frameSurfaces[fd.frame_id];
-
-                if (f > 0 && startX + frame->w > 1024) {
-                    startX = 1;
-                    anim_y += maxRowY + 1;
-                    maxRowY = 0;
-                }
+                // Frames that don't exist were never drawn; leave them out
+                if (anim.entries[i].frame_data[f].frame_id >= anim.frames.size())
+                    continue;
 
-                if (maxRowY < (size_t)frame->h)
-                    maxRowY = frame->h;
-
-                if (sheetWidth < startX + frame->w + 1)
-                    sheetWidth = startX + frame->w + 1;
-                if (sheetHeight < anim_y + frame->h + 1)
-                    sheetHeight = anim_y + frame->h + 1;
-
-                SDL_Rect dst = {
-                    (int)startX, (int)anim_y,
-                    frame->w, frame->h,
-                };
-                SDL_FillRect(result, &dst, SDL_MapRGBA(result->format, 0x00, 0x00, 0x00, 0x00));
-                SDL_BlitSurface(frame, NULL, result, &dst);
+                size_t id = canonical[anim.entries[i].frame_data[f].frame_id];
+                SDL_Rect rect = frameRects[id];
 
                 RSDK_AnimFrame anfrm;
-                anfrm.SheetNumber = 0;
+                anfrm.SheetNumber = frameSheets[id];
                 anfrm.Duration = 0x100;
                 anfrm.ID = 0;
-                anfrm.X = startX;
-                anfrm.Y = anim_y;
-                anfrm.W = frame->w;
-                anfrm.H = frame->h;
-                anfrm.OffX = frame->w / -2;
-                anfrm.OffY = frame->h / -2;
+                anfrm.X = rect.x;
+                anfrm.Y = rect.y;
+                anfrm.W = rect.w;
+                anfrm.H = rect.h;
+                anfrm.OffX = rect.w / -2;
+                anfrm.OffY = rect.h / -2;
                 Animations.back().Frames.push_back(anfrm);
-
-                startX += frame->w + 1;
             }
-            anim_y += maxRowY + 1;
         }
 
-        IMG_SavePNG(result, filename);
-        SDL_FreeSurface(result);
+        // Sheets are drawn in horizontal bands, one band per task. Every
+        // frame in a band is drawn straight from its textures onto a view of
+        // its rect's rows in that band, which clips its pieces to both. New
+        // surfaces start out transparent, so there is nothing to clear.
+        for (size_t s = 0; s < packers.size(); s++) {
+            SDL_Surface* result = SDL_CreateRGBSurfaceWithFormat(0, packers[s]->UsedWidth + 1, packers[s]->UsedHeight + 1, 32, SDL_PIXELFORMAT_RGBA32);
+
+            int bandHeight = sheetThreads > 1 ? SHEET_BAND_HEIGHT : result->h;
+            int bandCount = (result->h + bandHeight - 1) / bandHeight;
+            ThreadPool::ParallelFor(sheetThreads, bandCount, [&](size_t b) {
+                int top = (int)b * bandHeight;
+                int bottom = std::min(top + bandHeight, result->h);
+                for (size_t o = 0; o < sheetFrames[s].size(); o++) {
+                    size_t id = sheetFrames[s][o];
+                    SDL_Rect rect = frameRects[id];
+                    int y0 = std::max(rect.y, top);
+                    int y1 = std::min(rect.y + rect.h, bottom);
+                    if (y0 >= y1 || rect.w <= 0)
+                        continue;
+
+                    SDL_Surface* view = SDL_CreateRGBSurfaceWithFormatFrom(
+                        (uint8_t*)result->pixels + y0 * result->pitch + rect.x * 4,
+                        rect.w, y1 - y0, 32, result->pitch, SDL_PIXELFORMAT_RGBA32);
+                    BlitSurfaceFromFrame(view, &textures, &anim.framePlans[id], 0, rect.y - y0);
+                    SDL_FreeSurface(view);
+                }
 
-        for (size_t t = 0; t < anim.frames.size(); t++) {
-            SDL_FreeSurface(anim.frameSurfaces[t]);
+                // Copied and rotated pieces keep the texture's color under
+                // zero alpha; clear it as blending the frame in used to
+                for (int y = top; y < bottom; y++) {
+                    uint32_t* row = (uint32_t*)((uint8_t*)result->pixels + y * result->pitch);
+                    for (int x = 0; x < result->w; x++) {
+                        if (!(row[x] & 0xFF000000))
+                            row[x] = 0;
+                    }
+                }
+            });
+
+            // Later sheets don't draw from these, and the encoder doesn't
+            // need them either
+            for (size_t t = 0; t < sheetReleases[s].size(); t++)
+                ReleaseTexture(&textures, sheetReleases[s][t]);
+
+            char sheetFilename[512];
+            GetSheetFilename(sheetFilename, filename, (int)s);
+            SaveImage(result, sheetFilename);
+            SDL_FreeSurface(result);
+            packers[s]->Close();
         }
-    }
 
-    if (freeSurfs) {
-        for (size_t t = 0; t < anim.textureSurfaces.size(); t++) {
-            SDL_FreeSurface(anim.textureSurfaces[t]);
-        }
+        textures.readOnly = false;
     }
 
-    size_t str_len = strlen(filename);
+    if (freeSurfs)
+        ReleaseTextures(&textures);
+
+    // The sheet's extension depends on the image format
     char animationFilename[512];
-    strcpy(animationFilename, filename);
-    animationFilename[str_len] = 0;
-    animationFilename[str_len - 3] = 'b';
-    animationFilename[str_len - 2] = 'i';
-    animationFilename[str_len - 1] = 'n';
+    const char* extension = strrchr(filename, '.');
+    sprintf(animationFilename, "%.*s.bin", extension ? (int)(extension - filename) : (int)strlen(filename), filename);
 
-    FileStream* writer = FileStream::New(animationFilename, FileStream::WRITE_ACCESS);
+    MemoryStream* writer = MemoryStream::New((size_t)0);
     if (!writer) return;
 
     writer->WriteUInt32(0x00525053);
     writer->WriteUInt32(0x00000000);
 
-    int sheets = 1;
     char suppie[256];
-    writer->WriteByte(sheets);
-    for (int i = 0; i < 1; i++) {
-        sprintf(suppie, "%s%s", weirdChamp, strrchr(filename, '/'));
+    writer->WriteByte(sheetCount);
+    for (int i = 0; i < sheetCount; i++) {
+        char sheetFilename[512];
+        GetSheetFilename(sheetFilename, filename, i);
+        sprintf(suppie, "%s%s", weirdChamp, strrchr(sheetFilename, '/'));
         writer->WriteHeaderedString(suppie);
     }
 
@@ -1100,14 +2198,14 @@ void         ExtractANIM(anim_t anim, const char* filename, bool freeSurfs) {
         }
     }
 
-    writer->Close();
+    WriteOutput(animationFilename, writer);
 }
 void         ExtractWAVE(wave_t wave, const char* filename, bool freeData) {
-    FileStream* writer = FileStream::New(filename, FileStream::WRITE_ACCESS);
-    if (!writer) return;
-
     int bytesPerSample = 2;
 
+    MemoryStream* writer = MemoryStream::New((size_t)44 + wave.header.sample_count * wave.header.channel_count * bytesPerSample);
+    if (!writer) return;
+
     writer->WriteUInt32(0x46464952);
     writer->WriteUInt32(36 + wave.header.sample_count * wave.header.channel_count * bytesPerSample);
     writer->WriteUInt32(0x45564157);
@@ -1124,11 +2222,9 @@ void         ExtractWAVE(wave_t wave, const char* filename, bool freeData) {
     writer->WriteUInt32(0x61746164);
     writer->WriteUInt32(wave.header.sample_count * wave.header.channel_count * bytesPerSample);
 
-    for (Uint32 i = 0; i < wave.header.sample_count * wave.header.channel_count; i++) {
-        writer->WriteInt16(wave.samples[i]);
-    }
+    writer->WriteBytes(wave.samples, wave.header.sample_count * wave.header.channel_count * bytesPerSample);
 
-    writer->Close();
+    WriteOutput(filename, writer);
 
     if (freeData) {
         // free samples
@@ -1143,72 +2239,915 @@ void         ExtractWAVE(wave_t wave, const char* filename, bool freeData) {
     animationFilename[str_len - 2] = 'x';
     animationFilename[str_len - 1] = 't';
 
-    writer = FileStream::New(animationFilename, FileStream::WRITE_ACCESS);
-    if (!writer) return;
-
     char texttt[200];
     sprintf(texttt, "loop point: %d", wave.header.loop_start);
 
-    writer->WriteBytes(texttt, strlen(texttt));
-    writer->WriteByte(0);
-    writer->Close();
+    WriteOutput(animationFilename, (uint8_t*)strdup(texttt), strlen(texttt) + 1);
 }
-void         ExtractVOL(const char* in_filename, const char* out_folder) {
-    FileStream* reader = FileStream::New(in_filename, FileStream::READ_ACCESS);
-    if (reader) {
-        vol_t vol = ReadVOL(reader);
+enum {
+    VOL_ENTRY_OTHER = 1 << 0,
+    VOL_ENTRY_WAVE  = 1 << 1,
+    VOL_ENTRY_IMAGE = 1 << 2,
+    VOL_ENTRY_ANIM  = 1 << 3,
+    VOL_ENTRY_ALL   = 0xF,
+};
 
-        Directory_Create(out_folder);
+int             extractTypes = VOL_ENTRY_ALL;
+vector<char*>   includeGlobs;
+vector<char*>   excludeGlobs;
+vector<regex>   includeRegexes;
+vector<regex>   excludeRegexes;
+
+int          GetVOLEntryType(const char* name) {
+    const char* extension = strrchr(name, '.');
+    if (!extension)
+        return VOL_ENTRY_OTHER;
+
+    if (!strcmp(extension, ".wave"))
+        return VOL_ENTRY_WAVE;
+    if (!strcmp(extension, ".image"))
+        return VOL_ENTRY_IMAGE;
+    if (!strcmp(extension, ".anim"))
+        return VOL_ENTRY_ANIM;
+    return VOL_ENTRY_OTHER;
+}
+bool         MatchGlob(const char* pattern, const char* string) {
+    // '*' matches any run of characters (including '/'), '?' one character,
+    // '[abc]', '[a-z]' and '[!abc]' a character class.
+    const char* starPattern = NULL;
+    const char* starString = NULL;
+    while (*string) {
+        if (*pattern == '*') {
+            starPattern = ++pattern;
+            starString = string;
+            continue;
+        }
 
-        // printReadInfo = true;
+        bool matched = false;
+        const char* next = pattern + 1;
+        if (*pattern == '?') {
+            matched = true;
+        }
+        else if (*pattern == '[' && strchr(pattern + 1, ']')) {
+            const char* p = pattern + 1;
+            bool negate = *p == '!' || *p == '^';
+            if (negate) p++;
+
+            bool inClass = false;
+            do {
+                if (p[1] == '-' && p[2] && p[2] != ']') {
+                    if (*string >= p[0] && *string <= p[2])
+                        inClass = true;
+                    p += 3;
+                }
+                else {
+                    if (*string == *p)
+                        inClass = true;
+                    p++;
+                }
+            }
+            while (*p && *p != ']');
+
+            matched = inClass != negate;
+            next = p + 1;
+        }
+        else if (*pattern) {
+            matched = *pattern == *string;
+        }
+
+        if (matched) {
+            pattern = next;
+            string++;
+        }
+        else if (starPattern) {
+            pattern = starPattern;
+            string = ++starString;
+        }
+        else {
+            return false;
+        }
+    }
 
-        char filename[256];
-        for (size_t i = 0; i < vol.fileStrings.size(); i++) {
-            printf("vol: %s\n", vol.fileStrings[i]);
+    while (*pattern == '*')
+        pattern++;
+    return !*pattern;
+}
+bool         IsGlobLiteral(const char* pattern) {
+    return !strpbrk(pattern, "*?[");
+}
+bool         IsVOLEntrySelected(const char* name) {
+    if (!(extractTypes & GetVOLEntryType(name)))
+        return false;
+
+    if (includeGlobs.size() || includeRegexes.size()) {
+        bool included = false;
+        for (size_t i = 0; i < includeGlobs.size() && !included; i++)
+            included = MatchGlob(includeGlobs[i], name);
+        for (size_t i = 0; i < includeRegexes.size() && !included; i++)
+            included = regex_search(name, includeRegexes[i]);
+        if (!included)
+            return false;
+    }
 
-            if (strstr(vol.fileStrings[i], ".wave")) {
-                sprintf(filename, "%s%s%s.wav", out_folder, out_folder[strlen(out_folder) - 1] == '/' ? "" : "/", vol.fileStrings[i]);
+    for (size_t i = 0; i < excludeGlobs.size(); i++)
+        if (MatchGlob(excludeGlobs[i], name))
+            return false;
+    for (size_t i = 0; i < excludeRegexes.size(); i++)
+        if (regex_search(name, excludeRegexes[i]))
+            return false;
 
-                reader->Seek(vol.fileMap->Get(vol.fileStrings[i])->vol_offset);
-                wave_t wave = ReadWAVE(reader);
+    return true;
+}
+// Resolves the filters to entry indices (in archive order) before anything
+// is read, so unselected entries are never seeked to or parsed.
+vector<size_t> SelectVOLEntries(vol_t* vol) {
+    vector<size_t> selected;
+
+    bool literalOnly = includeGlobs.size() && !includeRegexes.size();
+    for (size_t i = 0; i < includeGlobs.size() && literalOnly; i++)
+        literalOnly = IsGlobLiteral(includeGlobs[i]);
+
+    if (literalOnly) {
+        // Plain names go straight through the directory map. It's keyed on
+        // the name's hash alone, so a miss or a colliding name falls back
+        // to comparing every name.
+        vector<bool> marked(vol->fileStrings.size(), false);
+        for (size_t i = 0; i < includeGlobs.size(); i++) {
+            vol_file_t* file = vol->fileMap->Get(includeGlobs[i]);
+            size_t index = file ? file - vol->files : marked.size();
+            if (index < marked.size() && !strcmp(vol->fileStrings[index], includeGlobs[i])) {
+                marked[index] = true;
+                continue;
+            }
 
-                ExtractWAVE(wave, filename, true);
+            for (size_t f = 0; f < marked.size(); f++) {
+                if (!strcmp(vol->fileStrings[f], includeGlobs[i]))
+                    marked[f] = true;
             }
-            // /*
-            else if (strstr(vol.fileStrings[i], ".image")) {
-                sprintf(filename, "%s%s%s.png", out_folder, out_folder[strlen(out_folder) - 1] == '/' ? "" : "/", vol.fileStrings[i]);
+        }
+        for (size_t i = 0; i < marked.size(); i++) {
+            if (marked[i] && IsVOLEntrySelected(vol->fileStrings[i]))
+                selected.push_back(i);
+        }
+        return selected;
+    }
+
+    for (size_t i = 0; i < vol->fileStrings.size(); i++) {
+        if (IsVOLEntrySelected(vol->fileStrings[i]))
+            selected.push_back(i);
+    }
+    return selected;
+}
 
-                reader->Seek(vol.fileMap->Get(vol.fileStrings[i])->vol_offset);
-                image_t image = ReadIMAGE(reader);
+// Opens entry i as a SubStream bounded to its [vol_offset, +file_comp_size)
+// range, so a parser can never read into its neighbours. The range is
+// brought in with one forward read (or is the mapping itself), so the
+// parsers' seeks between headers, tables and texture data land in memory.
+// Only ReadAt is used on the archive, so any number of threads can do this
+// on one reader.
+SubStream*   ReadVOLEntry(vol_t* vol, size_t i, Stream* reader) {
+    vol_file_t* file = &vol->files[i];
 
-                ExtractIMAGE(image, filename, true);
+    MappedStream* mapped = dynamic_cast<MappedStream*>(reader);
+    if (mapped)
+        mapped->Prefetch(file->vol_offset, file->file_comp_size);
+
+    return SubStream::New(reader, file->vol_offset, file->file_comp_size, true);
+}
+// An entry on its way through parse -> decode -> encode -> write
+struct extract_job_t {
+    size_t                order; // Position in the schedule
+    size_t                index;
+    int                   type;
+    bool                  skipped;
+    SubStream*            entry;
+    Arena*                arena; // Everything parsed out of the entry
+    wave_t                wave;
+    anim_t                anim;
+    image_t               image;
+    vector<output_file_t> outputs;
+};
+
+// Arenas are handed from one entry to the next, so they stop growing once
+// they fit the largest entry
+std::mutex      arenaPoolLock;
+vector<Arena*>  arenaPool;
+
+Arena*       AcquireArena() {
+    {
+        std::lock_guard<std::mutex> guard(arenaPoolLock);
+        if (arenaPool.size()) {
+            Arena* arena = arenaPool.back();
+            arenaPool.pop_back();
+            return arena;
+        }
+    }
+    return Arena::New();
+}
+void         ReleaseArena(Arena* arena) {
+    arena->Reset();
+
+    std::lock_guard<std::mutex> guard(arenaPoolLock);
+    arenaPool.push_back(arena);
+}
+void         FreeArenaPool() {
+    std::lock_guard<std::mutex> guard(arenaPoolLock);
+    for (size_t i = 0; i < arenaPool.size(); i++)
+        arenaPool[i]->Close();
+    arenaPool.clear();
+}
+
+// Parse: header and tables only, the payload is decoded later
+void         ParseVOLEntry(extract_job_t* job, vol_t* vol, Stream* reader) {
+    job->entry = NULL;
+    job->arena = NULL;
+    if (job->type == VOL_ENTRY_OTHER)
+        return;
+
+    job->entry = ReadVOLEntry(vol, job->index, reader);
+    if (!job->entry)
+        return;
+
+    job->arena = AcquireArena();
+    if (!job->arena) {
+        job->entry->Close();
+        job->entry = NULL;
+        return;
+    }
+
+    switch (job->type) {
+        case VOL_ENTRY_WAVE:  job->wave = ReadWAVE(job->entry, false); break;
+        case VOL_ENTRY_IMAGE: job->image = ReadIMAGE(job->entry, job->arena); break;
+        case VOL_ENTRY_ANIM:  job->anim = ReadANIM(job->entry, job->arena); break;
+    }
+}
+// Decode: ADPCM samples, and the textures the drawn frames use
+void         DecodeVOLEntry(extract_job_t* job) {
+    if (!job->entry)
+        return;
+
+    switch (job->type) {
+        case VOL_ENTRY_WAVE:  DecodeWAVE(&job->wave, job->entry); break;
+        case VOL_ENTRY_IMAGE: DecodeIMAGETextures(&job->image); break;
+        case VOL_ENTRY_ANIM:  DecodeANIMTextures(&job->anim); break;
+    }
+}
+// Encode: build the output files and hand them to WriteOutput
+void         EncodeVOLEntry(extract_job_t* job, vol_t* vol, const char* out_folder) {
+    char filename[256];
+    const char* name = vol->fileStrings[job->index];
+    const char* separator = out_folder[strlen(out_folder) - 1] == '/' ? "" : "/";
+
+    if (!job->entry)
+        return;
+
+    switch (job->type) {
+        case VOL_ENTRY_WAVE:
+            sprintf(filename, "%s%s%s.wav", out_folder, separator, name);
+            ExtractWAVE(job->wave, filename, true);
+            break;
+        case VOL_ENTRY_IMAGE:
+            sprintf(filename, "%s%s%s.%s", out_folder, separator, name, imageExtensions[imageFormat]);
+            ExtractIMAGE(job->image, filename, true);
+            break;
+        case VOL_ENTRY_ANIM:
+            sprintf(filename, "%s%s%s.%s", out_folder, separator, name, imageExtensions[imageFormat]);
+            ExtractANIM(job->anim, filename, true);
+            break;
+    }
+
+    job->entry->Close();
+    job->entry = NULL;
+    ReleaseArena(job->arena);
+    job->arena = NULL;
+}
+void         ExtractVOLEntry(vol_t* vol, size_t i, Stream* reader, const char* out_folder) {
+    extract_job_t job;
+    job.index = i;
+    job.type = GetVOLEntryType(vol->fileStrings[i]);
+
+    ParseVOLEntry(&job, vol, reader);
+    DecodeVOLEntry(&job);
+    EncodeVOLEntry(&job, vol, out_folder);
+}
+// Prints an entry's header and frame geometry through the views, without
+// decoding any pixels or samples.
+bool         listOnly = false;
+
+void         ListVOLEntry(vol_t* vol, size_t i, Stream* reader) {
+    vol_file_t* file = &vol->files[i];
+    printf("%s: offset 0x%llX, size 0x%X\n", vol->fileStrings[i], (unsigned long long)file->vol_offset, file->file_comp_size);
+
+    int type = GetVOLEntryType(vol->fileStrings[i]);
+    if (type != VOL_ENTRY_ANIM && type != VOL_ENTRY_IMAGE)
+        return;
+
+    SubStream* entry = ReadVOLEntry(vol, i, reader);
+    if (!entry)
+        return;
+
+    frame_view_t frame;
+    if (type == VOL_ENTRY_ANIM) {
+        anim_view_t anim;
+        if (!anim.Open(entry->data, entry->size)) {
+            printf("    (malformed ANIM)\n");
+            entry->Close();
+            return;
+        }
+
+        printf("    %d animations, %d frames, %u textures\n", anim.EntryCount(), anim.FrameCount(), anim.textures.Count());
+        for (int a = 0; a < anim.EntryCount(); a++) {
+            const char* name = anim.EntryName(a);
+            anim_entry_t ae = anim.Entry(a);
+            printf("    animation %-24s %u frames:", name ? name : "?", ae.frame_count);
+
+            frame_data_t fd;
+            for (uint32_t f = 0; anim.EntryFrame(a, f, &fd); f++)
+                printf(" %d", fd.frame_id);
+            printf("\n");
+        }
+        for (int f = 0; f < anim.FrameCount(); f++) {
+            if (anim.Frame(f, &frame))
+                printf("    frame %4d %4ux%-4u %d pieces\n", f, frame.Width(), frame.Height(), frame.PieceCount());
+            else
+                printf("    frame %4d (malformed)\n", f);
+        }
+    }
+    else {
+        image_view_t image;
+        if (!image.Open(entry->data, entry->size)) {
+            printf("    (malformed IMAGE)\n");
+            entry->Close();
+            return;
+        }
+
+        printf("    %ux%u, %d pieces, %u textures\n", image.frame.Width(), image.frame.Height(), image.frame.PieceCount(), image.textures.Count());
+    }
+
+    entry->Close();
+}
+
+// Orders the work by where it lives in the archive, so the whole run reads
+// the file front to back instead of jumping around in directory order.
+void         ScheduleVOLEntries(vol_t* vol, vector<size_t>* selected) {
+    std::stable_sort(selected->begin(), selected->end(), [vol](size_t a, size_t b) {
+        return vol->files[a].vol_offset < vol->files[b].vol_offset;
+    });
+}
+
+// Output manifest ("<out_folder>.manifest")
+struct manifest_entry_t {
+    char*                     name;
+    uint64_t                  vol_offset;
+    uint32_t                  file_comp_size;
+    uint32_t                  unknown_hash;
+    char                      version[32];
+    vector<manifest_output_t> outputs;
+    size_t                    index; // In manifest_t::entries
+};
+struct manifest_t {
+    vector<manifest_entry_t*>                           entries;
+    std::unordered_map<std::string, manifest_entry_t*>  entryMap; // By full name
+    std::mutex                                          lock;
+};
+
+bool         useManifest = true;
+bool         forceExtract = false;
+
+bool         HashFile(const char* filename, uint64_t* size, uint64_t* hash) {
+    MappedStream* stream = MappedStream::New(filename);
+    if (!stream)
+        return false;
+
+    *size = stream->size;
+    *hash = HashBytes(stream->data, stream->size);
+    stream->Close();
+    return true;
+}
+void         GetManifestFilename(char* manifest_filename, size_t size, const char* out_folder) {
+    size_t length = strlen(out_folder);
+    while (length > 1 && out_folder[length - 1] == '/')
+        length--;
+    snprintf(manifest_filename, size, "%.*s.manifest", (int)length, out_folder);
+}
+void         FreeManifestEntry(manifest_entry_t* entry) {
+    free(entry->name);
+    for (size_t o = 0; o < entry->outputs.size(); o++) {
+        free(entry->outputs[o].filename);
+    }
+    delete entry;
+}
+void         PutManifestEntry(manifest_t* manifest, manifest_entry_t* entry) {
+    // Entries keep their place in the file when they are replaced
+    manifest_entry_t*& slot = manifest->entryMap[entry->name];
+    if (slot) {
+        entry->index = slot->index;
+        manifest->entries[entry->index] = entry;
+        FreeManifestEntry(slot);
+    }
+    else {
+        entry->index = manifest->entries.size();
+        manifest->entries.push_back(entry);
+    }
+    slot = entry;
+}
+void         ReadManifest(manifest_t* manifest, const char* out_folder) {
+    char manifest_filename[512];
+    GetManifestFilename(manifest_filename, sizeof(manifest_filename), out_folder);
+
+    MappedStream* reader = MappedStream::New(manifest_filename);
+    if (!reader)
+        return;
+
+    manifest_entry_t* entry = NULL;
+    while (reader->Position() < reader->Length()) {
+        char* line = reader->ReadLine();
+        line[strcspn(line, "\r\n")] = 0;
+
+        int nameStart = 0;
+        unsigned long long a, b;
+        char version[32];
+        manifest_entry_t parsed;
+        if (sscanf(line, "entry %llx %x %x %31s %n", &a, &parsed.file_comp_size, &parsed.unknown_hash, version, &nameStart) == 4 && nameStart) {
+            entry = new manifest_entry_t;
+            entry->name = strdup(line + nameStart);
+            entry->vol_offset = a;
+            entry->file_comp_size = parsed.file_comp_size;
+            entry->unknown_hash = parsed.unknown_hash;
+            strcpy(entry->version, version);
+            PutManifestEntry(manifest, entry);
+        }
+        else if (entry && sscanf(line, "output %llu %llx %n", &a, &b, &nameStart) == 2 && nameStart) {
+            manifest_output_t output;
+            output.filename = strdup(line + nameStart);
+            output.size = a;
+            output.hash = b;
+            entry->outputs.push_back(output);
+        }
+        free(line);
+    }
+    reader->Close();
+}
+void         WriteManifest(manifest_t* manifest, const char* out_folder) {
+    char manifest_filename[512];
+    char temp_filename[520];
+    GetManifestFilename(manifest_filename, sizeof(manifest_filename), out_folder);
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", manifest_filename);
+
+    FILE* f = fopen(temp_filename, "wb");
+    if (!f) return;
+
+    fprintf(f, "# vol_extract manifest\n");
+    for (size_t i = 0; i < manifest->entries.size(); i++) {
+        manifest_entry_t* entry = manifest->entries[i];
+        fprintf(f, "entry %llx %x %x %s %s\n",
+            (unsigned long long)entry->vol_offset,
+            entry->file_comp_size,
+            entry->unknown_hash,
+            entry->version,
+            entry->name);
+        for (size_t o = 0; o < entry->outputs.size(); o++) {
+            fprintf(f, "output %llu %llx %s\n",
+                (unsigned long long)entry->outputs[o].size,
+                (unsigned long long)entry->outputs[o].hash,
+                entry->outputs[o].filename);
+        }
+    }
+    fclose(f);
+
+    remove(manifest_filename);
+    rename(temp_filename, manifest_filename);
+}
+void         FreeManifest(manifest_t* manifest) {
+    for (size_t i = 0; i < manifest->entries.size(); i++) {
+        FreeManifestEntry(manifest->entries[i]);
+    }
+    manifest->entries.clear();
+    manifest->entryMap.clear();
+}
+void         SetExtractorVersion() {
+    if (imageFormat == IMAGE_FORMAT_PNG)
+        snprintf(extractorVersion, sizeof(extractorVersion), "%s-png%d-%d", EXTRACTOR_VERSION, pngLevel, sheetSizeLimit);
+    else
+        snprintf(extractorVersion, sizeof(extractorVersion), "%s-%s-%d", EXTRACTOR_VERSION, imageExtensions[imageFormat], sheetSizeLimit);
+}
+// An entry can be skipped when it hasn't moved or changed in the archive,
+// was extracted by this version, and every file it produced is untouched.
+bool         IsVOLEntryUpToDate(manifest_t* manifest, vol_t* vol, size_t i) {
+    manifest_entry_t* entry;
+    {
+        std::lock_guard<std::mutex> guard(manifest->lock);
+        auto it = manifest->entryMap.find(vol->fileStrings[i]);
+        entry = it != manifest->entryMap.end() ? it->second : NULL;
+    }
+
+    vol_file_t* file = &vol->files[i];
+    if (!entry
+        || entry->vol_offset != file->vol_offset
+        || entry->file_comp_size != file->file_comp_size
+        || entry->unknown_hash != file->unknown_hash
+        || strcmp(entry->version, extractorVersion))
+        return false;
+
+    for (size_t o = 0; o < entry->outputs.size(); o++) {
+        uint64_t size, hash;
+        if (!HashFile(entry->outputs[o].filename, &size, &hash)
+            || size != entry->outputs[o].size
+            || hash != entry->outputs[o].hash)
+            return false;
+    }
+    return true;
+}
+void         RecordVOLEntry(manifest_t* manifest, vol_t* vol, size_t i, vector<manifest_output_t>* outputs) {
+    manifest_entry_t* entry = new manifest_entry_t;
+    entry->name = strdup(vol->fileStrings[i]);
+    entry->vol_offset = vol->files[i].vol_offset;
+    entry->file_comp_size = vol->files[i].file_comp_size;
+    entry->unknown_hash = vol->files[i].unknown_hash;
+    strcpy(entry->version, extractorVersion);
+    entry->outputs = *outputs;
+
+    std::lock_guard<std::mutex> guard(manifest->lock);
+    PutManifestEntry(manifest, entry);
+}
+
+// Whether entry i can be skipped this run
+bool         CanSkipVOLEntry(manifest_t* manifest, vol_t* vol, size_t i) {
+    return useManifest && !forceExtract && IsVOLEntryUpToDate(manifest, vol, i);
+}
+// Extracts entry i and records what it produced in the manifest
+void         ExtractVOLEntryRecorded(manifest_t* manifest, vol_t* vol, size_t i, Stream* reader, const char* out_folder) {
+    if (!useManifest) {
+        ExtractVOLEntry(vol, i, reader, out_folder);
+        return;
+    }
+
+    vector<manifest_output_t> outputs;
+    entryOutputs = &outputs;
+    ExtractVOLEntry(vol, i, reader, out_folder);
+    entryOutputs = NULL;
+
+    RecordVOLEntry(manifest, vol, i, &outputs);
+}
+// Staged extraction: parse, decode, encode and write each run on their own
+// threads, handing jobs along through bounded queues so at most a few
+// entries per stage are in memory at once.
+enum {
+    PIPELINE_PARSE,
+    PIPELINE_DECODE,
+    PIPELINE_ENCODE,
+    PIPELINE_WRITE,
+    PIPELINE_STAGE_COUNT,
+};
+bool         usePipeline = false;
+int          pipelineThreads[PIPELINE_STAGE_COUNT] = { 1, 1, 1, 1 };
+
+void         ExtractVOLPipelined(vol_t* vol, vector<size_t>* selected, Stream* reader, manifest_t* manifest, const char* out_folder) {
+    BoundedQueue<extract_job_t*>* decodeQueue = BoundedQueue<extract_job_t*>::New(pipelineThreads[PIPELINE_DECODE] * 2, pipelineThreads[PIPELINE_PARSE]);
+    BoundedQueue<extract_job_t*>* encodeQueue = BoundedQueue<extract_job_t*>::New(pipelineThreads[PIPELINE_ENCODE] * 2, pipelineThreads[PIPELINE_DECODE]);
+    BoundedQueue<extract_job_t*>* writeQueue  = BoundedQueue<extract_job_t*>::New(pipelineThreads[PIPELINE_WRITE] * 2, pipelineThreads[PIPELINE_ENCODE]);
+
+    std::atomic<size_t> nextParsed(0);
+
+    // Jobs finish out of order; the log is flushed in schedule order
+    std::mutex logLock;
+    vector<bool> finished(selected->size(), false);
+    vector<bool> skipped(selected->size(), false);
+    size_t nextLogged = 0;
+
+    vector<std::thread> threads;
+    for (int t = 0; t < pipelineThreads[PIPELINE_PARSE]; t++) {
+        threads.push_back(std::thread([&] {
+            for (size_t s; (s = nextParsed.fetch_add(1)) < selected->size(); ) {
+                extract_job_t* job = new extract_job_t;
+                job->order = s;
+                job->index = (*selected)[s];
+                job->type = GetVOLEntryType(vol->fileStrings[job->index]);
+                job->entry = NULL;
+                job->arena = NULL;
+                job->skipped = CanSkipVOLEntry(manifest, vol, job->index);
+                if (!job->skipped)
+                    ParseVOLEntry(job, vol, reader);
+                decodeQueue->Push(job);
             }
-            else if (strstr(vol.fileStrings[i], ".anim")) {
-                sprintf(filename, "%s%s%s.png", out_folder, out_folder[strlen(out_folder) - 1] == '/' ? "" : "/", vol.fileStrings[i]);
+            decodeQueue->ProducerDone();
+        }));
+    }
+    for (int t = 0; t < pipelineThreads[PIPELINE_DECODE]; t++) {
+        threads.push_back(std::thread([&] {
+            extract_job_t* job;
+            while (decodeQueue->Pop(&job)) {
+                DecodeVOLEntry(job);
+                encodeQueue->Push(job);
+            }
+            encodeQueue->ProducerDone();
+        }));
+    }
+    for (int t = 0; t < pipelineThreads[PIPELINE_ENCODE]; t++) {
+        threads.push_back(std::thread([&] {
+            extract_job_t* job;
+            while (encodeQueue->Pop(&job)) {
+                pendingOutputs = &job->outputs;
+                EncodeVOLEntry(job, vol, out_folder);
+                pendingOutputs = NULL;
+                writeQueue->Push(job);
+            }
+            writeQueue->ProducerDone();
+        }));
+    }
+    bool ordered = OrderOutputs();
+    vector<vector<output_file_t>> heldOutputs(ordered ? selected->size() : 0);
+    for (int t = 0; t < pipelineThreads[PIPELINE_WRITE]; t++) {
+        threads.push_back(std::thread([&] {
+            extract_job_t* job;
+            while (writeQueue->Pop(&job)) {
+                if (!ordered) {
+                    vector<manifest_output_t> outputs;
+                    entryOutputs = &outputs;
+                    WriteOutputFiles(&job->outputs);
+                    entryOutputs = NULL;
+
+                    if (useManifest && !job->skipped)
+                        RecordVOLEntry(manifest, vol, job->index, &outputs);
+                    else
+                        for (size_t o = 0; o < outputs.size(); o++)
+                            free(outputs[o].filename);
+                }
+
+                std::lock_guard<std::mutex> guard(logLock);
+                finished[job->order] = true;
+                skipped[job->order] = job->skipped;
+                if (ordered)
+                    heldOutputs[job->order].swap(job->outputs);
+                for (; nextLogged < finished.size() && finished[nextLogged]; nextLogged++) {
+                    printf("vol: %s%s\n", vol->fileStrings[(*selected)[nextLogged]], skipped[nextLogged] ? " (unchanged)" : "");
+                    if (ordered)
+                        WriteOutputFiles(&heldOutputs[nextLogged]);
+                }
+                delete job;
+            }
+        }));
+    }
+
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    decodeQueue->Close();
+    encodeQueue->Close();
+    writeQueue->Close();
+}
+// Returns false if the .vol couldn't be read or any output couldn't be written
+bool         ExtractVOL(const char* in_filename, const char* out_folder) {
+    Stream* reader = MappedStream::New(in_filename);
+    if (!reader) // Not mappable (pipe, special file), fall back to buffered stdio
+        reader = BufferedStream::New(FileStream::New(in_filename, FileStream::READ_ACCESS));
+    if (reader) {
+        vol_t vol;
+        if (!useVOLIndex || !ReadVOLIndex(&vol, in_filename, reader)) {
+            vol = ReadVOL(reader);
+            if (useVOLIndex)
+                WriteVOLIndex(&vol, in_filename);
+        }
+
+        // printReadInfo = true;
+
+        vector<size_t> selected = SelectVOLEntries(&vol);
+        ScheduleVOLEntries(&vol, &selected);
+
+        if (listOnly) {
+            for (size_t s = 0; s < selected.size(); s++)
+                ListVOLEntry(&vol, selected[s], reader);
+
+            FreeVOL(&vol);
+            reader->Close();
+            return true;
+        }
 
-                reader->Seek(vol.fileMap->Get(vol.fileStrings[i])->vol_offset);
-                anim_t anim = ReadANIM(reader);
+        TarWriter* tar = NULL;
+        if (tarFilename) {
+            // Entries stamped with the archive's time, so the same .vol gives the same tar
+            uint64_t vol_size = 0;
+            int64_t vol_mtime = 0;
+            GetVOLIndexKey(in_filename, &vol_size, &vol_mtime);
+
+            tar = OpenTarOutput(tarFilename, vol_mtime);
+            if (!tar) {
+                FreeVOL(&vol);
+                reader->Close();
+                return false;
+            }
+            // Nothing lands in out_folder, so there's nothing for a manifest to track
+            useManifest = false;
+        }
+        else
+            Directory_Create(out_folder);
+        outputWriter = OutputWriter::New(writerThreads, syncOutputs, tar);
+
+        manifest_t manifest;
+        if (useManifest)
+            ReadManifest(&manifest, out_folder);
+
+        if (usePipeline)
+            ExtractVOLPipelined(&vol, &selected, reader, &manifest, out_folder);
+        else if (threadCount <= 1) {
+            for (size_t s = 0; s < selected.size(); s++) {
+                if (CanSkipVOLEntry(&manifest, &vol, selected[s])) {
+                    printf("vol: %s (unchanged)\n", vol.fileStrings[selected[s]]);
+                    continue;
+                }
 
-                ExtractANIM(anim, filename, true);
+                printf("vol: %s\n", vol.fileStrings[selected[s]]);
+                ExtractVOLEntryRecorded(&manifest, &vol, selected[s], reader, out_folder);
             }
-            //*/
-            free(vol.fileStrings[i]);
         }
+        else {
+            // Entries finish out of order; the log (and, for a tar, the
+            // outputs) are flushed in schedule order
+            std::mutex logLock;
+            vector<bool> finished(selected.size(), false);
+            vector<bool> skipped(selected.size(), false);
+            size_t nextLogged = 0;
+            bool ordered = OrderOutputs();
+            vector<vector<output_file_t>> heldOutputs(ordered ? selected.size() : 0);
+
+            ThreadPool* pool = ThreadPool::New(threadCount);
+            for (size_t s = 0; s < selected.size(); s++) {
+                pool->Submit([&, s] {
+                    bool skip = CanSkipVOLEntry(&manifest, &vol, selected[s]);
+                    vector<output_file_t> outputs;
+                    if (!skip) {
+                        pendingOutputs = ordered ? &outputs : NULL;
+                        ExtractVOLEntryRecorded(&manifest, &vol, selected[s], reader, out_folder);
+                        pendingOutputs = NULL;
+                    }
+
+                    std::lock_guard<std::mutex> guard(logLock);
+                    finished[s] = true;
+                    skipped[s] = skip;
+                    if (ordered)
+                        heldOutputs[s].swap(outputs);
+                    for (; nextLogged < finished.size() && finished[nextLogged]; nextLogged++) {
+                        printf("vol: %s%s\n", vol.fileStrings[selected[nextLogged]], skipped[nextLogged] ? " (unchanged)" : "");
+                        if (ordered)
+                            WriteOutputFiles(&heldOutputs[nextLogged]);
+                    }
+                });
+            }
+            pool->Close();
+        }
+
+        ClearTextureCache();
+        FreeArenaPool();
+
+        // Every output is on disk before the manifest vouches for it
+        int failures = outputWriter->Finish();
+        outputWriter->Close();
+        outputWriter = NULL;
+        if (failures)
+            printf("%d output file%s could not be written\n", failures, failures == 1 ? "" : "s");
+
+        if (useManifest) {
+            WriteManifest(&manifest, out_folder);
+            FreeManifest(&manifest);
+        }
+
+        FreeVOL(&vol);
+        reader->Close();
+        return failures == 0;
     }
+    return false;
 }
 
 int main(int argc, char* args[]) {
-    FILE* res;
-    if ((res = fopen("8x8_Font.bin", "r"))) {
-        fread(Font8x8_basic, 1, 0x400, res);
-    	fclose(res);
+    const char* in_filename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(args[i], "-j") && i + 1 < argc)
+            threadCount = atoi(args[++i]);
+        else if (!strncmp(args[i], "-j", 2) && args[i][2])
+            threadCount = atoi(args[i] + 2);
+        else if (!strcmp(args[i], "--pipeline") && i + 1 < argc) {
+            // Comma separated thread counts for parse,decode,encode,write
+            char* counts = args[++i];
+            int stage = 0;
+            for (char* count = strtok(counts, ","); count && stage < PIPELINE_STAGE_COUNT; count = strtok(NULL, ","), stage++) {
+                pipelineThreads[stage] = atoi(count);
+                if (pipelineThreads[stage] <= 0)
+                    pipelineThreads[stage] = ThreadPool::HardwareThreads();
+            }
+            usePipeline = true;
+        }
+        else if (!strcmp(args[i], "--writers") && i + 1 < argc)
+            writerThreads = atoi(args[++i]);
+        else if (!strcmp(args[i], "--tar") && i + 1 < argc)
+            tarFilename = args[++i];
+        else if (!strcmp(args[i], "--texture-cache") && i + 1 < argc)
+            textureCacheLimit = (size_t)atoi(args[++i]) << 20;
+        else if (!strcmp(args[i], "--sheet-size") && i + 1 < argc)
+            sheetSizeLimit = atoi(args[++i]);
+        else if (!strcmp(args[i], "--sheet-threads") && i + 1 < argc) {
+            sheetThreads = atoi(args[++i]);
+            if (sheetThreads <= 0)
+                sheetThreads = ThreadPool::HardwareThreads();
+        }
+        else if (!strcmp(args[i], "--format") && i + 1 < argc) {
+            const char* format = args[++i];
+            if (!strcmp(format, "png"))
+                imageFormat = IMAGE_FORMAT_PNG;
+            else if (!strcmp(format, "qoi"))
+                imageFormat = IMAGE_FORMAT_QOI;
+            else if (!strcmp(format, "raw"))
+                imageFormat = IMAGE_FORMAT_RAW;
+            else
+                printf("Unknown image format \"%s\"\n", format);
+        }
+        else if (!strcmp(args[i], "--png-level") && i + 1 < argc)
+            pngLevel = atoi(args[++i]);
+        else if (!strcmp(args[i], "--png-threads") && i + 1 < argc) {
+            pngThreads = atoi(args[++i]);
+            if (pngThreads <= 0)
+                pngThreads = ThreadPool::HardwareThreads();
+        }
+        else if (!strcmp(args[i], "--wave-threads") && i + 1 < argc) {
+            waveThreads = atoi(args[++i]);
+            if (waveThreads <= 0)
+                waveThreads = ThreadPool::HardwareThreads();
+        }
+        else if (!strcmp(args[i], "--fsync"))
+            syncOutputs = true;
+        else if (!strcmp(args[i], "--no-index"))
+            useVOLIndex = false;
+        else if (!strcmp(args[i], "--list"))
+            listOnly = true;
+        else if (!strcmp(args[i], "--no-manifest"))
+            useManifest = false;
+        else if (!strcmp(args[i], "--force"))
+            forceExtract = true;
+        else if (!strcmp(args[i], "--include") && i + 1 < argc)
+            includeGlobs.push_back(args[++i]);
+        else if (!strcmp(args[i], "--exclude") && i + 1 < argc)
+            excludeGlobs.push_back(args[++i]);
+        else if (!strcmp(args[i], "--include-regex") && i + 1 < argc)
+            includeRegexes.push_back(regex(args[++i], regex::extended));
+        else if (!strcmp(args[i], "--exclude-regex") && i + 1 < argc)
+            excludeRegexes.push_back(regex(args[++i], regex::extended));
+        else if (!strcmp(args[i], "--type") && i + 1 < argc) {
+            // Comma separated list of wave, image, anim
+            char* types = args[++i];
+            extractTypes = 0;
+            for (char* type = strtok(types, ","); type; type = strtok(NULL, ",")) {
+                if (!strcmp(type, "wave"))
+                    extractTypes |= VOL_ENTRY_WAVE;
+                else if (!strcmp(type, "image"))
+                    extractTypes |= VOL_ENTRY_IMAGE;
+                else if (!strcmp(type, "anim"))
+                    extractTypes |= VOL_ENTRY_ANIM;
+                else
+                    printf("Unknown entry type \"%s\"\n", type);
+            }
+        }
+        else
+            in_filename = args[i];
     }
 
-    if (argc == 1) {
-        printf("Usage:\n%s <vol-filename>\n", args[0]);
+    if (!in_filename) {
+        printf("Usage:\n%s [options] <vol-filename>\n", args[0]);
+        printf("  -j <threads>  Extract entries on this many threads (0 = all cores)\n");
+        printf("  --pipeline <parse,decode,encode,write>\n");
+        printf("                Run extraction as a pipeline with this many threads per stage (0 = all cores)\n");
+        printf("  --writers <threads>\n");
+        printf("                Write output files on this many background threads (0 = write inline, default 2)\n");
+        printf("  --tar <file>  Write all output into one tar archive (\"-\" for stdout) instead of separate files\n");
+        printf("  --texture-cache <MB>\n");
+        printf("                Share decoded textures between entries, keeping up to this much (0 = off, default 256)\n");
+        printf("  --sheet-size <pixels>\n");
+        printf("                Largest sprite sheet width/height; frames that don't fit go on more sheets (default 2048)\n");
+        printf("  --sheet-threads <threads>\n");
+        printf("                Draw each sprite sheet on this many threads, in bands (0 = all cores, default 1)\n");
+        printf("  --format <png|qoi|raw>\n");
+        printf("                Format of images and sprite sheets (raw = 16-byte header + RGBA8888, default png)\n");
+        printf("  --png-level <0-9>\n");
+        printf("                PNG compression level (0 = store, default 6)\n");
+        printf("  --png-threads <threads>\n");
+        printf("                Filter and compress each PNG on this many threads (0 = all cores, default 1)\n");
+        printf("  --wave-threads <threads>\n");
+        printf("                Decode the channels of each long sound on up to this many threads (0 = all cores, default 1)\n");
+        printf("  --fsync       Flush output files to disk (in batches) before finishing\n");
+        printf("  --no-index    Don't read or write the <vol-filename>.idx directory cache\n");
+        printf("  --list        Print entries with their animation and frame layout, extract nothing\n");
+        printf("  --no-manifest Don't read or write the output manifest (<output>.manifest)\n");
+        printf("  --force       Extract every entry, even ones the manifest says are unchanged\n");
+        printf("  --include <glob>, --exclude <glob>\n");
+        printf("                Only extract entries whose names match (or don't match) the pattern\n");
+        printf("  --include-regex <regex>, --exclude-regex <regex>\n");
+        printf("                Same, with an extended regular expression\n");
+        printf("  --type <types>\n");
+        printf("                Only extract these entry types (comma separated: wave,image,anim)\n");
         return 0;
     }
 
-    ExtractVOL(args[1], "output");
-    return 0;
+    if (threadCount <= 0)
+        threadCount = ThreadPool::HardwareThreads();
+    SetExtractorVersion();
+
+    return ExtractVOL(in_filename, "output") ? 0 : 1;
 }
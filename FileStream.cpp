@@ -1,5 +1,14 @@
 #include "FileStream.h"
 
+#include <string.h>
+
+#ifdef WIN32
+    #include <io.h>
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+
 FileStream* FileStream::New(const char* filename, Uint32 access) {
     FileStream* stream = new FileStream;
     if (!stream) {
@@ -31,6 +40,18 @@ FileStream* FileStream::New(const char* filename, Uint32 access) {
     stream->size = ftell(stream->f);
     fseek(stream->f, 0, SEEK_SET);
 
+    stream->overlappedHandle = NULL;
+    #ifdef WIN32
+    // ReadFile moves a synchronous handle's file pointer even when given an
+    // offset, so ReadAt goes through a second, overlapped handle instead
+    if (access == FileStream::READ_ACCESS) {
+        HANDLE handle = ReOpenFile((HANDLE)_get_osfhandle(_fileno(stream->f)), GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_OVERLAPPED);
+        if (handle != INVALID_HANDLE_VALUE)
+            stream->overlappedHandle = handle;
+    }
+    #endif
+
     return stream;
 
     FREE:
@@ -38,7 +59,27 @@ FileStream* FileStream::New(const char* filename, Uint32 access) {
         return NULL;
 }
 
+// Takes over an already open FILE* (such as stdout), closed by Close
+FileStream* FileStream::New(FILE* file) {
+    if (!file)
+        return NULL;
+
+    FileStream* stream = new FileStream;
+    if (!stream) {
+        return NULL;
+    }
+
+    stream->f = file;
+    stream->size = 0;
+    stream->overlappedHandle = NULL;
+    return stream;
+}
+
 void        FileStream::Close() {
+    #ifdef WIN32
+    if (overlappedHandle)
+        CloseHandle((HANDLE)overlappedHandle);
+    #endif
     fclose(f);
     f = NULL;
     Stream::Close();
@@ -64,6 +105,63 @@ size_t      FileStream::ReadBytes(void* data, int n) {
     return fread(data, 1, n, f);
 }
 
+size_t      FileStream::ReadAt(uint64_t offset, void* data, size_t n) {
+    #ifdef WIN32
+    if (!overlappedHandle)
+        return Stream::ReadAt(offset, data, n);
+
+    // Each call waits on its own event, so calls on several threads don't
+    // complete each other
+    HANDLE event = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!event)
+        return 0;
+
+    size_t read = 0;
+    while (read < n) {
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)(offset + read);
+        overlapped.OffsetHigh = (DWORD)((offset + read) >> 32);
+        overlapped.hEvent = event;
+
+        DWORD count = 0;
+        DWORD chunk = n - read > 0x40000000 ? 0x40000000 : (DWORD)(n - read);
+        if (!ReadFile((HANDLE)overlappedHandle, (uint8_t*)data + read, chunk, NULL, &overlapped)
+            && GetLastError() != ERROR_IO_PENDING)
+            break;
+        if (!GetOverlappedResult((HANDLE)overlappedHandle, &overlapped, &count, TRUE) || count == 0)
+            break;
+        read += count;
+    }
+
+    CloseHandle(event);
+    return read;
+    #else
+    // pread leaves the FILE*'s cursor alone, so this is safe next to other readers
+    size_t read = 0;
+    while (read < n) {
+        ssize_t count = pread(fileno(f), (uint8_t*)data + read, n - read, offset + read);
+        if (count <= 0)
+            break;
+        read += count;
+    }
+    return read;
+    #endif
+}
+
 size_t      FileStream::WriteBytes(void* data, int n) {
     return fwrite(data, 1, n, f);
 }
+bool        FileStream::Flush() {
+    return fflush(f) == 0 && !ferror(f);
+}
+// Flushes stdio's buffer and asks the OS to commit the file to disk
+bool        FileStream::Sync() {
+    if (fflush(f) != 0)
+        return false;
+    #ifdef WIN32
+    return _commit(_fileno(f)) == 0;
+    #else
+    return fsync(fileno(f)) == 0;
+    #endif
+}
@@ -8,6 +8,7 @@ class FileStream : public Stream {
 public:
     FILE*  f;
     size_t size;
+    void*  overlappedHandle; // WIN32: read-only handle used by ReadAt
     enum {
         READ_ACCESS = 0,
         WRITE_ACCESS = 1,
@@ -15,6 +16,7 @@ public:
     };
 
     FileStream* New(const char* filename, uint32_t access);
+    static FileStream* New(FILE* file);
     void        Close();
     void        Seek(int64_t offset);
     void        SeekEnd(int64_t offset);
@@ -22,7 +24,10 @@ public:
     size_t      Position();
     size_t      Length();
     size_t      ReadBytes(void* data, int n);
+    size_t      ReadAt(uint64_t offset, void* data, size_t n);
     size_t      WriteBytes(void* data, int n);
+    bool        Flush();
+    bool        Sync();
 };
 
 #endif /* FILESTREAM_H */
@@ -231,6 +231,17 @@ public:
         }
     }
 
+    // Puts data in a specific slot, for restoring a table saved from a map
+    // with the same Capacity without rehashing every key.
+    void     SetSlot(int index, uint32_t hash, T data) {
+        if (!Data[index].Used)
+            Count++;
+
+        Data[index].Key = hash;
+        Data[index].Used = true;
+        Data[index].Data = data;
+    }
+
     Uint8*   GetBytes(bool exportHashes) {
         uint32_t stride = ((exportHashes ? 4 : 0) + sizeof(T));
         Uint8* bytes = (Uint8*)malloc(Count * stride);
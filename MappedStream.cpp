@@ -0,0 +1,114 @@
+#include "MappedStream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+MappedStream* MappedStream::New(const char* filename) {
+    MappedStream* stream = new MappedStream;
+    if (!stream) {
+        return NULL;
+    }
+
+    stream->data = NULL;
+    stream->size = 0;
+    stream->owned = false;
+
+    #ifdef WIN32
+    stream->mapping = NULL;
+    stream->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (stream->file == INVALID_HANDLE_VALUE)
+        goto FREE;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(stream->file, &fileSize))
+        goto CLOSE;
+
+    stream->size = (size_t)fileSize.QuadPart;
+    if (stream->size) {
+        stream->mapping = CreateFileMappingA(stream->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!stream->mapping)
+            goto CLOSE;
+
+        stream->data = (uint8_t*)MapViewOfFile(stream->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!stream->data) {
+            CloseHandle(stream->mapping);
+            goto CLOSE;
+        }
+    }
+    #else
+    stream->fd = open(filename, O_RDONLY);
+    if (stream->fd < 0)
+        goto FREE;
+
+    struct stat st;
+    if (fstat(stream->fd, &st) != 0 || !S_ISREG(st.st_mode))
+        goto CLOSE;
+
+    stream->size = (size_t)st.st_size;
+    if (stream->size) {
+        void* map = mmap(NULL, stream->size, PROT_READ, MAP_SHARED, stream->fd, 0);
+        if (map == MAP_FAILED)
+            goto CLOSE;
+
+        stream->data = (uint8_t*)map;
+    }
+    #endif
+
+    stream->ReadCursor = stream->data;
+    stream->ReadEnd = stream->data + stream->size;
+    return stream;
+
+    CLOSE:
+        #ifdef WIN32
+        CloseHandle(stream->file);
+        #else
+        close(stream->fd);
+        #endif
+    FREE:
+        delete stream;
+        return NULL;
+}
+
+// Asks the OS to start reading a range in ahead of use
+void        MappedStream::Prefetch(size_t offset, size_t length) {
+    if (!data || offset >= size)
+        return;
+    if (length > size - offset)
+        length = size - offset;
+
+    #ifndef WIN32
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    madvise(data + start, length + (offset - start), MADV_WILLNEED);
+    #endif
+}
+
+void        MappedStream::Close() {
+    #ifdef WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping)
+        CloseHandle(mapping);
+    CloseHandle(file);
+    #else
+    if (data)
+        munmap(data, size);
+    close(fd);
+    #endif
+    data = NULL;
+    ReadCursor = ReadEnd = NULL;
+    Stream::Close();
+}
+size_t      MappedStream::WriteBytes(void* data, int n) {
+    // Mappings are read-only
+    return 0;
+}
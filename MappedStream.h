@@ -0,0 +1,22 @@
+#ifndef MAPPEDSTREAM_H
+#define MAPPEDSTREAM_H
+
+#include "MemoryStream.h"
+
+// Read-only MemoryStream over a whole file mapped into memory
+class MappedStream : public MemoryStream {
+public:
+    #ifdef WIN32
+    void*    file;
+    void*    mapping;
+    #else
+    int      fd;
+    #endif
+
+    static MappedStream* New(const char* filename);
+    void        Prefetch(size_t offset, size_t length);
+    void        Close();
+    size_t      WriteBytes(void* data, int n);
+};
+
+#endif /* MAPPEDSTREAM_H */
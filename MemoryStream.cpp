@@ -0,0 +1,122 @@
+#include "MemoryStream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Allocates and owns a zeroed buffer of the given size
+MemoryStream* MemoryStream::New(size_t size) {
+    void* data = calloc(size ? size : 1, 1);
+    if (!data) {
+        return NULL;
+    }
+
+    MemoryStream* stream = MemoryStream::New(data, size);
+    if (!stream) {
+        free(data);
+        return NULL;
+    }
+
+    stream->owned = true;
+    return stream;
+}
+// Reads from memory owned by someone else, which must outlive the stream
+MemoryStream* MemoryStream::New(void* data, size_t size) {
+    MemoryStream* stream = new MemoryStream;
+    if (!stream) {
+        return NULL;
+    }
+
+    stream->data = (uint8_t*)data;
+    stream->size = size;
+    stream->capacity = size;
+    stream->owned = false;
+    stream->ReadCursor = stream->data;
+    stream->ReadEnd = stream->data + size;
+    return stream;
+}
+
+void        MemoryStream::Close() {
+    if (owned)
+        free(data);
+    data = NULL;
+    Stream::Close();
+}
+void        MemoryStream::Seek(int64_t offset) {
+    if (offset < 0)
+        offset = 0;
+    if ((uint64_t)offset > size)
+        offset = size;
+    ReadCursor = data + offset;
+}
+void        MemoryStream::SeekEnd(int64_t offset) {
+    Seek((int64_t)size + offset);
+}
+void        MemoryStream::Skip(int64_t offset) {
+    Seek((int64_t)Position() + offset);
+}
+size_t      MemoryStream::Position() {
+    return ReadCursor - data;
+}
+size_t      MemoryStream::Length() {
+    return size;
+}
+
+size_t      MemoryStream::ReadBytes(void* data, int n) {
+    if (n <= 0 || ReadCursor >= ReadEnd)
+        return 0;
+
+    size_t count = (size_t)n;
+    if (count > (size_t)(ReadEnd - ReadCursor))
+        count = ReadEnd - ReadCursor;
+
+    memcpy(data, ReadCursor, count);
+    ReadCursor += count;
+    return count;
+}
+size_t      MemoryStream::ReadAt(uint64_t offset, void* data, size_t n) {
+    if (offset >= size)
+        return 0;
+    if (n > size - offset)
+        n = size - offset;
+
+    memcpy(data, this->data + offset, n);
+    return n;
+}
+
+bool        MemoryStream::Grow(size_t size) {
+    if (size > capacity) {
+        size_t newCapacity = capacity < 0x100 ? 0x100 : capacity * 2;
+        if (newCapacity < size)
+            newCapacity = size;
+
+        uint8_t* newData = (uint8_t*)realloc(data, newCapacity);
+        if (!newData)
+            return false;
+
+        ReadCursor = newData + (ReadCursor - data);
+        data = newData;
+        capacity = newCapacity;
+    }
+
+    this->size = size;
+    ReadEnd = data + size;
+    return true;
+}
+size_t      MemoryStream::WriteBytes(void* data, int n) {
+    if (n <= 0)
+        return 0;
+
+    if (owned && (size_t)(ReadEnd - ReadCursor) < (size_t)n)
+        Grow(Position() + n);
+
+    if (ReadCursor >= ReadEnd)
+        return 0;
+
+    size_t count = (size_t)n;
+    if (count > (size_t)(ReadEnd - ReadCursor))
+        count = ReadEnd - ReadCursor;
+
+    memcpy(ReadCursor, data, count);
+    ReadCursor += count;
+    return count;
+}
@@ -0,0 +1,33 @@
+#ifndef MEMORYSTREAM_H
+#define MEMORYSTREAM_H
+
+#include <stddef.h>
+#include "Stream.h"
+
+// Stream over a buffer. The whole buffer is the read window, so every
+// primitive read is an inline pointer read. Streams that own their buffer
+// grow it when written past the end.
+class MemoryStream : public Stream {
+public:
+    uint8_t* data;
+    size_t   size;
+    size_t   capacity;
+    bool     owned;
+
+    static MemoryStream* New(size_t size);
+    static MemoryStream* New(void* data, size_t size);
+    void        Close();
+    void        Seek(int64_t offset);
+    void        SeekEnd(int64_t offset);
+    void        Skip(int64_t offset);
+    size_t      Position();
+    size_t      Length();
+    size_t      ReadBytes(void* data, int n);
+    size_t      ReadAt(uint64_t offset, void* data, size_t n);
+    size_t      WriteBytes(void* data, int n);
+
+private:
+    bool        Grow(size_t size);
+};
+
+#endif /* MEMORYSTREAM_H */
@@ -0,0 +1,194 @@
+#include "OutputWriter.h"
+#include "FileStream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+    #include <windows.h>
+#else
+    #include <errno.h>
+    #include <sys/stat.h>
+#endif
+
+OutputWriter* OutputWriter::New(int threadCount, bool syncFiles, TarWriter* tar) {
+    if (threadCount < 0)
+        threadCount = 0;
+    if (tar && threadCount > 1)
+        threadCount = 1;
+
+    OutputWriter* writer = new OutputWriter;
+    if (!writer) {
+        return NULL;
+    }
+
+    writer->ThreadCount = threadCount;
+    writer->SyncFiles = syncFiles;
+    writer->SyncBatchSize = 32;
+    writer->Queue = NULL;
+    writer->Failures = 0;
+    writer->Tar = tar;
+
+    if (threadCount > 0) {
+        // A few buffers per worker is enough to keep them busy without
+        // letting finished files pile up in memory
+        writer->Queue = BoundedQueue<Output>::New(threadCount * 16, 1);
+        if (!writer->Queue)
+            goto FREE;
+
+        for (int i = 0; i < threadCount; i++) {
+            writer->Threads.push_back(std::thread(&OutputWriter::Run, writer));
+        }
+    }
+
+    return writer;
+
+    FREE:
+        delete writer;
+        return NULL;
+}
+
+static bool MakeDirectory(const char* path) {
+    #ifdef WIN32
+        return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+    #else
+        return mkdir(path, 0777) == 0 || errno == EEXIST;
+    #endif
+}
+// Creates path and any missing parents
+bool OutputWriter::CreateDirectories(const char* path) {
+    char buffer[1024];
+    size_t length = strlen(path);
+    if (length == 0 || length >= sizeof(buffer))
+        return false;
+    memcpy(buffer, path, length + 1);
+
+    for (size_t i = 1; i <= length; i++) {
+        if (buffer[i] != '/' && buffer[i] != '\\' && buffer[i] != 0)
+            continue;
+        // Drive letters ("C:") aren't directories to create
+        if (buffer[i - 1] == ':' || buffer[i - 1] == '/' || buffer[i - 1] == '\\')
+            continue;
+
+        char separator = buffer[i];
+        buffer[i] = 0;
+        bool made = MakeDirectory(buffer);
+        buffer[i] = separator;
+        if (!made)
+            return false;
+    }
+    return true;
+}
+bool OutputWriter::CreateParentDirectories(const char* filename) {
+    const char* slash = strrchr(filename, '/');
+    #ifdef WIN32
+    const char* backslash = strrchr(filename, '\\');
+    if (backslash > slash)
+        slash = backslash;
+    #endif
+    if (!slash || slash == filename)
+        return true;
+
+    std::string folder(filename, slash - filename);
+    {
+        std::lock_guard<std::mutex> guard(DirectoryLock);
+        if (Directories.count(folder))
+            return true;
+    }
+
+    // Two workers may race to make the same folder; both succeed
+    if (!CreateDirectories(folder.c_str()))
+        return false;
+
+    std::lock_guard<std::mutex> guard(DirectoryLock);
+    Directories.insert(folder);
+    return true;
+}
+
+// Takes ownership of filename and data, both freed once written
+void OutputWriter::Write(char* filename, uint8_t* data, size_t size) {
+    Output output;
+    output.Filename = filename;
+    output.Data = data;
+    output.Size = size;
+
+    if (!Queue) {
+        WriteFile(&output, NULL);
+        return;
+    }
+    Queue->Push(output);
+}
+// No more files may be written afterwards
+int  OutputWriter::Finish() {
+    if (Queue) {
+        Queue->ProducerDone();
+        for (size_t i = 0; i < Threads.size(); i++) {
+            Threads[i].join();
+        }
+        Threads.clear();
+        Queue->Close();
+        Queue = NULL;
+    }
+    if (Tar) {
+        if (!Tar->Close()) {
+            printf("Could not finish the tar archive\n");
+            Failures++;
+        }
+        Tar = NULL;
+    }
+    return Failures;
+}
+void OutputWriter::Close() {
+    Finish();
+    delete this;
+}
+
+bool OutputWriter::WriteFile(Output* output, std::vector<FileStream*>* unsynced) {
+    bool written = false;
+    if (Tar) {
+        std::lock_guard<std::mutex> guard(TarLock);
+        written = Tar->Add(output->Filename, output->Data, output->Size);
+    }
+    else if (CreateParentDirectories(output->Filename)) {
+        FileStream* stream = FileStream::New(output->Filename, FileStream::WRITE_ACCESS);
+        if (stream) {
+            written = stream->WriteBytes(output->Data, (int)output->Size) == output->Size;
+            if (SyncFiles && unsynced)
+                unsynced->push_back(stream);
+            else {
+                if (SyncFiles)
+                    written = stream->Sync() && written;
+                stream->Close();
+            }
+        }
+    }
+
+    if (!written) {
+        printf("Could not write \"%s\"\n", output->Filename);
+        Failures++;
+    }
+
+    free(output->Filename);
+    free(output->Data);
+    return written;
+}
+void OutputWriter::SyncBatch(std::vector<FileStream*>* unsynced) {
+    for (size_t i = 0; i < unsynced->size(); i++) {
+        FileStream* stream = (*unsynced)[i];
+        if (!stream->Sync())
+            Failures++;
+        stream->Close();
+    }
+    unsynced->clear();
+}
+void OutputWriter::Run() {
+    std::vector<FileStream*> unsynced;
+
+    Output output;
+    while (Queue->Pop(&output)) {
+        WriteFile(&output, &unsynced);
+        if ((int)unsynced.size() >= SyncBatchSize)
+            SyncBatch(&unsynced);
+    }
+    SyncBatch(&unsynced);
+}
@@ -0,0 +1,56 @@
+#ifndef OUTPUTWRITER_H
+#define OUTPUTWRITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "BoundedQueue.h"
+#include "TarWriter.h"
+
+class FileStream;
+
+// Writes finished files off the caller's thread. Write queues a buffer and
+// returns; worker threads create the parent directories, then open, write and
+// close the file. Directories already made are remembered, so each is only
+// created once per run. With sync set, each worker fsyncs its files in batches
+// before closing them. With zero threads, Write does all of this inline.
+// Given a TarWriter, files are appended to the archive instead, by at most
+// one worker so the stream is written in the order Write was called.
+// Finish waits for everything queued and returns how many files failed.
+class OutputWriter {
+public:
+    struct Output {
+        char*    Filename;
+        uint8_t* Data;
+        size_t   Size;
+    };
+
+    int                             ThreadCount;
+    bool                            SyncFiles;
+    int                             SyncBatchSize;
+    BoundedQueue<Output>*           Queue;
+    std::vector<std::thread>        Threads;
+    std::mutex                      DirectoryLock;
+    std::unordered_set<std::string> Directories;
+    std::atomic<int>                Failures;
+    TarWriter*                      Tar;
+    std::mutex                      TarLock;
+
+    static OutputWriter* New(int threadCount, bool syncFiles, TarWriter* tar = NULL);
+    static bool          CreateDirectories(const char* path);
+    bool                 CreateParentDirectories(const char* filename);
+    void                 Write(char* filename, uint8_t* data, size_t size);
+    int                  Finish();
+    void                 Close();
+
+private:
+    bool                 WriteFile(Output* output, std::vector<FileStream*>* unsynced);
+    void                 SyncBatch(std::vector<FileStream*>* unsynced);
+    void                 Run();
+};
+
+#endif /* OUTPUTWRITER_H */
@@ -0,0 +1,216 @@
+#include "PNGWriter.h"
+#include "ThreadPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+
+// Filtered bytes deflated per band; large enough that the flush at each band
+// boundary costs nothing measurable
+#define PNG_BAND_SIZE   (256 * 1024)
+#define PNG_WINDOW_SIZE 32768
+
+struct png_band_t {
+    uint8_t* data;
+    size_t   size;
+    size_t   filteredSize;
+    uLong    adler;
+};
+
+static inline int Paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    if (pb <= pc)
+        return b;
+    return c;
+}
+
+// Picks the filter whose output has the smallest sum of absolute values
+// (read as signed bytes), the usual libpng heuristic, and writes the row
+// with its filter type byte in front
+static void FilterRow(uint8_t* out, const uint8_t* row, const uint8_t* prev, size_t length) {
+    uint32_t costs[5] = { 0, 0, 0, 0, 0 };
+    for (size_t i = 0; i < length; i++) {
+        int x = row[i];
+        int a = i >= 4 ? row[i - 4] : 0;
+        int b = prev[i];
+        int c = i >= 4 ? prev[i - 4] : 0;
+        costs[0] += abs((int8_t)x);
+        costs[1] += abs((int8_t)(x - a));
+        costs[2] += abs((int8_t)(x - b));
+        costs[3] += abs((int8_t)(x - ((a + b) >> 1)));
+        costs[4] += abs((int8_t)(x - Paeth(a, b, c)));
+    }
+
+    int type = 0;
+    for (int t = 1; t < 5; t++) {
+        if (costs[t] < costs[type])
+            type = t;
+    }
+
+    out[0] = type;
+    for (size_t i = 0; i < length; i++) {
+        int x = row[i];
+        int a = i >= 4 ? row[i - 4] : 0;
+        int b = prev[i];
+        int c = i >= 4 ? prev[i - 4] : 0;
+        switch (type) {
+            case 0: out[1 + i] = x; break;
+            case 1: out[1 + i] = x - a; break;
+            case 2: out[1 + i] = x - b; break;
+            case 3: out[1 + i] = x - ((a + b) >> 1); break;
+            case 4: out[1 + i] = x - Paeth(a, b, c); break;
+        }
+    }
+}
+
+static void WriteChunk(Stream* output, const char* type, const uint8_t* data, size_t size) {
+    output->WriteUInt32BE((uint32_t)size);
+    output->WriteBytes((void*)type, 4);
+    if (size)
+        output->WriteBytes((void*)data, (int)size);
+
+    uLong crc = crc32(0, (const Bytef*)type, 4);
+    if (size)
+        crc = crc32(crc, data, (uInt)size);
+    output->WriteUInt32BE((uint32_t)crc);
+}
+
+bool PNGWriter::Write(Stream* output, const uint8_t* pixels, int width, int height, int pitch, int level, int threadCount) {
+    if (width <= 0 || height <= 0)
+        return false;
+    if (level < 0)
+        level = 0;
+    if (level > 9)
+        level = 9;
+
+    size_t length = (size_t)width * 4;
+    size_t rowSize = length + 1;
+    size_t bandRows = PNG_BAND_SIZE / rowSize;
+    if (bandRows < 1)
+        bandRows = 1;
+    size_t bandCount = (height + bandRows - 1) / bandRows;
+
+    std::vector<uint8_t> zeroRow(length, 0);
+    std::vector<png_band_t> bands(bandCount);
+    uint8_t* filtered = (uint8_t*)malloc(rowSize * height);
+    if (!filtered)
+        return false;
+
+    // Rows only depend on the pixels above them, not on how those were
+    // filtered, so every band can be filtered at once
+    ThreadPool::ParallelFor(threadCount, bandCount, [&](size_t b) {
+        size_t end = (b + 1) * bandRows < (size_t)height ? (b + 1) * bandRows : height;
+        for (size_t y = b * bandRows; y < end; y++) {
+            uint8_t* out = filtered + y * rowSize;
+            const uint8_t* row = pixels + y * pitch;
+            if (level == 0) {
+                out[0] = 0;
+                memcpy(out + 1, row, length);
+            }
+            else {
+                FilterRow(out, row, y > 0 ? row - pitch : zeroRow.data(), length);
+            }
+        }
+    });
+
+    // The first band carries the zlib header and the last one has room
+    // left for the Adler-32 of the whole stream
+    ThreadPool::ParallelFor(threadCount, bandCount, [&](size_t b) {
+        png_band_t* band = &bands[b];
+        band->data = NULL;
+        band->size = 0;
+
+        uint8_t* start = filtered + b * bandRows * rowSize;
+        size_t end = (b + 1) * bandRows < (size_t)height ? (b + 1) * bandRows : height;
+        size_t size = (end - b * bandRows) * rowSize;
+        band->filteredSize = size;
+        band->adler = adler32(adler32(0, NULL, 0), start, (uInt)size);
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, level ? Z_FILTERED : Z_DEFAULT_STRATEGY) != Z_OK)
+            return;
+
+        if (b > 0 && level > 0) {
+            size_t window = b * bandRows * rowSize < PNG_WINDOW_SIZE ? b * bandRows * rowSize : PNG_WINDOW_SIZE;
+            deflateSetDictionary(&stream, start - window, (uInt)window);
+        }
+
+        size_t bound = deflateBound(&stream, size) + 64;
+        size_t offset = b == 0 ? 2 : 0;
+        uint8_t* data = (uint8_t*)malloc(offset + bound + 4);
+        if (!data) {
+            deflateEnd(&stream);
+            return;
+        }
+
+        bool last = b == bandCount - 1;
+        stream.next_in = start;
+        stream.avail_in = (uInt)size;
+        stream.next_out = data + offset;
+        stream.avail_out = (uInt)bound;
+        int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        bool done = last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0 && stream.avail_out > 0);
+        size_t written = bound - stream.avail_out;
+        deflateEnd(&stream);
+
+        if (!done) {
+            free(data);
+            return;
+        }
+
+        if (b == 0) {
+            // CMF/FLG for a 32K window, with the level hint zlib would write
+            static const uint8_t levelFlags[10] = { 0x01, 0x01, 0x5E, 0x5E, 0x5E, 0x5E, 0x9C, 0xDA, 0xDA, 0xDA };
+            data[0] = 0x78;
+            data[1] = levelFlags[level];
+        }
+        band->data = data;
+        band->size = offset + written;
+    });
+    free(filtered);
+
+    bool ok = true;
+    uLong adler = 0;
+    for (size_t b = 0; b < bandCount; b++) {
+        if (!bands[b].data)
+            ok = false;
+        adler = b == 0 ? bands[b].adler : adler32_combine(adler, bands[b].adler, (z_off_t)bands[b].filteredSize);
+    }
+
+    if (ok) {
+        static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        output->WriteBytes((void*)signature, sizeof(signature));
+
+        uint8_t header[13];
+        for (int i = 0; i < 4; i++) {
+            header[i] = (uint8_t)(width >> (24 - i * 8));
+            header[4 + i] = (uint8_t)(height >> (24 - i * 8));
+        }
+        header[8] = 8;  // bit depth
+        header[9] = 6;  // RGBA
+        header[10] = 0; // deflate
+        header[11] = 0; // adaptive filtering
+        header[12] = 0; // not interlaced
+        WriteChunk(output, "IHDR", header, sizeof(header));
+
+        // One IDAT per band, the last one ending with the stream's Adler-32
+        png_band_t* lastBand = &bands[bandCount - 1];
+        for (int i = 0; i < 4; i++)
+            lastBand->data[lastBand->size++] = (uint8_t)(adler >> (24 - i * 8));
+        for (size_t b = 0; b < bandCount; b++)
+            WriteChunk(output, "IDAT", bands[b].data, bands[b].size);
+
+        WriteChunk(output, "IEND", NULL, 0);
+    }
+
+    for (size_t b = 0; b < bandCount; b++)
+        free(bands[b].data);
+    return ok;
+}
@@ -0,0 +1,18 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <stdint.h>
+#include "Stream.h"
+
+// Encodes 8-bit RGBA images as PNG. The image is cut into bands of rows that
+// are filtered and deflated independently, so both steps run on several
+// threads. As in pigz, each band is deflated with the end of the previous
+// band as its dictionary and flushed to a byte boundary, so the pieces join
+// into one zlib stream with hardly any loss in ratio. Level 0 stores rows
+// unfiltered and uncompressed.
+class PNGWriter {
+public:
+    static bool Write(Stream* output, const uint8_t* pixels, int width, int height, int pitch, int level, int threadCount);
+};
+
+#endif /* PNGWRITER_H */
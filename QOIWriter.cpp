@@ -0,0 +1,106 @@
+#include "QOIWriter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xC0
+#define QOI_OP_RGB   0xFE
+#define QOI_OP_RGBA  0xFF
+
+static inline void PutUInt32BE(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+bool QOIWriter::Write(Stream* output, const uint8_t* pixels, int width, int height, int pitch) {
+    if (width <= 0 || height <= 0)
+        return false;
+
+    // Worst case every pixel is a QOI_OP_RGBA
+    size_t pixelCount = (size_t)width * height;
+    uint8_t* data = (uint8_t*)malloc(14 + pixelCount * 5 + 8);
+    if (!data)
+        return false;
+
+    uint8_t* out = data;
+    memcpy(out, "qoif", 4);
+    PutUInt32BE(out + 4, width);
+    PutUInt32BE(out + 8, height);
+    out[12] = 4; // RGBA
+    out[13] = 0; // sRGB with linear alpha
+    out += 14;
+
+    uint8_t index[64][4];
+    memset(index, 0, sizeof(index));
+    uint8_t prev[4] = { 0, 0, 0, 255 };
+    int run = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* px = pixels + (size_t)y * pitch;
+        for (int x = 0; x < width; x++, px += 4) {
+            if (!memcmp(px, prev, 4)) {
+                if (++run == 62) {
+                    *out++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            int slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+            if (!memcmp(index[slot], px, 4)) {
+                *out++ = QOI_OP_INDEX | slot;
+            }
+            else {
+                memcpy(index[slot], px, 4);
+
+                if (px[3] == prev[3]) {
+                    int8_t dr = (int8_t)(px[0] - prev[0]);
+                    int8_t dg = (int8_t)(px[1] - prev[1]);
+                    int8_t db = (int8_t)(px[2] - prev[2]);
+                    int8_t drg = (int8_t)(dr - dg);
+                    int8_t dbg = (int8_t)(db - dg);
+
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                        *out++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                    }
+                    else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                        *out++ = QOI_OP_LUMA | (dg + 32);
+                        *out++ = (drg + 8) << 4 | (dbg + 8);
+                    }
+                    else {
+                        *out++ = QOI_OP_RGB;
+                        *out++ = px[0];
+                        *out++ = px[1];
+                        *out++ = px[2];
+                    }
+                }
+                else {
+                    *out++ = QOI_OP_RGBA;
+                    memcpy(out, px, 4);
+                    out += 4;
+                }
+            }
+            memcpy(prev, px, 4);
+        }
+    }
+    if (run)
+        *out++ = QOI_OP_RUN | (run - 1);
+
+    static const uint8_t padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    memcpy(out, padding, sizeof(padding));
+    out += sizeof(padding);
+
+    size_t size = out - data;
+    bool written = output->WriteBytes(data, (int)size) == size;
+    free(data);
+    return written;
+}
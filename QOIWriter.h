@@ -0,0 +1,15 @@
+#ifndef QOIWRITER_H
+#define QOIWRITER_H
+
+#include <stdint.h>
+#include "Stream.h"
+
+// Encodes 8-bit RGBA images in the Quite OK Image format (qoiformat.org):
+// one pass over the pixels, no entropy coding, and several times faster to
+// write and read back than PNG.
+class QOIWriter {
+public:
+    static bool Write(Stream* output, const uint8_t* pixels, int width, int height, int pitch);
+};
+
+#endif /* QOIWRITER_H */
@@ -0,0 +1,103 @@
+#include "SkylinePacker.h"
+
+SkylinePacker* SkylinePacker::New(int width, int height) {
+    if (width <= 0 || height <= 0)
+        return NULL;
+
+    SkylinePacker* packer = new SkylinePacker;
+    if (!packer) {
+        return NULL;
+    }
+
+    packer->Width = width;
+    packer->Height = height;
+    packer->UsedWidth = 0;
+    packer->UsedHeight = 0;
+
+    Segment floor = { 0, 0, width };
+    packer->Skyline.push_back(floor);
+    return packer;
+}
+
+// Lowest y a rectangle can sit at with its left edge on segment index, or -1
+int  SkylinePacker::Fit(size_t index, int width, int height) {
+    int x = Skyline[index].X;
+    if (x + width > Width)
+        return -1;
+
+    int y = 0;
+    int widthLeft = width;
+    for (size_t i = index; widthLeft > 0; i++) {
+        if (i == Skyline.size())
+            return -1;
+        if (y < Skyline[i].Y)
+            y = Skyline[i].Y;
+        if (y + height > Height)
+            return -1;
+        widthLeft -= Skyline[i].Width;
+    }
+    return y;
+}
+void SkylinePacker::Place(size_t index, int x, int y, int width, int height) {
+    Segment top = { x, y + height, width };
+    Skyline.insert(Skyline.begin() + index, top);
+
+    // Cut away whatever the new segment now covers
+    for (size_t i = index + 1; i < Skyline.size(); ) {
+        int covered = Skyline[i - 1].X + Skyline[i - 1].Width - Skyline[i].X;
+        if (covered <= 0)
+            break;
+
+        Skyline[i].X += covered;
+        Skyline[i].Width -= covered;
+        if (Skyline[i].Width > 0)
+            break;
+        Skyline.erase(Skyline.begin() + i);
+    }
+
+    // Neighbours at the same height become one segment
+    for (size_t i = 0; i + 1 < Skyline.size(); ) {
+        if (Skyline[i].Y == Skyline[i + 1].Y) {
+            Skyline[i].Width += Skyline[i + 1].Width;
+            Skyline.erase(Skyline.begin() + i + 1);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+bool SkylinePacker::Insert(int width, int height, int* x, int* y) {
+    size_t bestIndex = 0;
+    int bestBottom = -1;
+    int bestWidth = 0;
+    int bestY = 0;
+    for (size_t i = 0; i < Skyline.size(); i++) {
+        int fitY = Fit(i, width, height);
+        if (fitY < 0)
+            continue;
+
+        int bottom = fitY + height;
+        if (bestBottom < 0 || bottom < bestBottom || (bottom == bestBottom && Skyline[i].Width < bestWidth)) {
+            bestIndex = i;
+            bestBottom = bottom;
+            bestWidth = Skyline[i].Width;
+            bestY = fitY;
+        }
+    }
+    if (bestBottom < 0)
+        return false;
+
+    *x = Skyline[bestIndex].X;
+    *y = bestY;
+    Place(bestIndex, *x, *y, width, height);
+
+    if (UsedWidth < *x + width)
+        UsedWidth = *x + width;
+    if (UsedHeight < *y + height)
+        UsedHeight = *y + height;
+    return true;
+}
+void SkylinePacker::Close() {
+    delete this;
+}
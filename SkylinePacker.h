@@ -0,0 +1,35 @@
+#ifndef SKYLINEPACKER_H
+#define SKYLINEPACKER_H
+
+#include <stddef.h>
+#include <vector>
+
+// Packs rectangles into a fixed-size bin with the skyline bottom-left
+// heuristic. The skyline is the top edge of everything placed so far, kept as
+// a list of horizontal segments; each rectangle goes where its bottom edge
+// ends up lowest, ties broken by the narrower segment so gaps fill first.
+// Rectangles are never rotated.
+class SkylinePacker {
+public:
+    struct Segment {
+        int X;
+        int Y;
+        int Width;
+    };
+
+    int                  Width;
+    int                  Height;
+    int                  UsedWidth;
+    int                  UsedHeight;
+    std::vector<Segment> Skyline;
+
+    static SkylinePacker* New(int width, int height);
+    bool                  Insert(int width, int height, int* x, int* y);
+    void                  Close();
+
+private:
+    int                   Fit(size_t index, int width, int height);
+    void                  Place(size_t index, int x, int y, int width, int height);
+};
+
+#endif /* SKYLINEPACKER_H */
@@ -1,8 +1,6 @@
 #include "Stream.h"
 
-#define READ_TYPE_MACRO(type) \
-    type data; \
-    ReadBytes(&data, sizeof(data));
+#include <stdlib.h>
 
 void     Stream::Close() {
     delete this;
@@ -23,76 +21,72 @@ size_t   Stream::Length() {
 size_t   Stream::ReadBytes(void* data, int n) {
     return 0;
 }
-uint8_t  Stream::ReadByte() {
-    READ_TYPE_MACRO(uint8_t);
-    return data;
-}
-uint16_t Stream::ReadUInt16() {
-    READ_TYPE_MACRO(uint16_t);
-    return data;
-}
-uint16_t Stream::ReadUInt16BE() {
-    return (uint16_t)(ReadByte() << 8 | ReadByte());
-}
-uint32_t Stream::ReadUInt32() {
-    READ_TYPE_MACRO(uint32_t);
-    return data;
-}
-uint32_t Stream::ReadUInt32BE() {
-    return (uint32_t)(ReadByte() << 24 | ReadByte() << 16 | ReadByte() << 8 | ReadByte());
-}
-uint64_t Stream::ReadUInt64() {
-    READ_TYPE_MACRO(uint64_t);
-    return data;
-}
-int16_t  Stream::ReadInt16() {
-    READ_TYPE_MACRO(int16_t);
-    return data;
-}
-int16_t  Stream::ReadInt16BE() {
-    return (int16_t)(ReadByte() << 8 | ReadByte());
-}
-int32_t  Stream::ReadInt32() {
-    READ_TYPE_MACRO(int32_t);
-    return data;
-}
-int32_t  Stream::ReadInt32BE() {
-    return (int32_t)(ReadByte() << 24 | ReadByte() << 16 | ReadByte() << 8 | ReadByte());
-}
-int64_t  Stream::ReadInt64() {
-    READ_TYPE_MACRO(int64_t);
-    return data;
-}
-float    Stream::ReadFloat() {
-    READ_TYPE_MACRO(float);
-    return data;
-}
-char*    Stream::ReadLine() {
-    uint8_t byte;
-    size_t start = Position();
-    while ((byte = ReadByte()) != '\n' && byte);
+// Reads at an absolute offset without using the stream's position, so
+// several threads can read one stream. Streams that can't do that natively
+// fall back to seeking, which is not safe to share.
+size_t   Stream::ReadAt(uint64_t offset, void* data, size_t n) {
+    size_t position = Position();
+    Seek(offset);
+    size_t count = ReadBytes(data, n);
+    Seek(position);
+    return count;
+}
+// Reads up to and including the terminator (or a NUL), returning the bytes
+// as a new string (with the terminator only if includeTerminator).
+char*    Stream::ReadUntil(int terminator, bool includeTerminator) {
+    // Fast path: the whole string is already in the read window
+    if (ReadCursor < ReadEnd) {
+        size_t available = ReadEnd - ReadCursor;
+        uint8_t* end = (uint8_t*)memchr(ReadCursor, 0, available);
+        if (terminator) {
+            uint8_t* line = (uint8_t*)memchr(ReadCursor, terminator, end ? end - ReadCursor : available);
+            if (line)
+                end = line;
+        }
+
+        if (end) {
+            size_t size = end - ReadCursor;
+            size_t copied = size + (includeTerminator && *end ? 1 : 0);
+
+            char* data = (char*)malloc(copied + 1);
+            memcpy(data, ReadCursor, copied);
+            data[copied] = 0;
+
+            ReadCursor = end + 1;
+            return data;
+        }
+    }
 
-    size_t size = Position() - start;
+    size_t start = Position();
+    size_t length = Length();
+    uint8_t byte = 0;
+    bool terminated = false;
+    while (Position() < length) {
+        byte = ReadByte();
+        if (byte == terminator || !byte) {
+            terminated = true;
+            break;
+        }
+    }
+
+    size_t end = Position();
+    size_t size = end - start;
+    if (terminated && (!includeTerminator || !byte))
+        size--;
 
     char* data = (char*)malloc(size + 1);
-    Skip(-size);
+    Seek(start);
     ReadBytes(data, size);
     data[size] = 0;
+    Seek(end);
 
     return data;
 }
+char*    Stream::ReadLine() {
+    return ReadUntil('\n', true);
+}
 char*    Stream::ReadString() {
-    size_t start = Position();
-    while (ReadByte());
-
-    size_t size = Position() - start;
-
-    char* data = (char*)malloc(size + 1);
-    Skip(-size);
-    ReadBytes(data, size);
-    data[size] = 0;
-
-    return data;
+    return ReadUntil(0, false);
 }
 char*    Stream::ReadHeaderedString() {
     uint8_t size = ReadByte();
@@ -107,6 +101,10 @@ char*    Stream::ReadHeaderedString() {
 size_t   Stream::WriteBytes(void* data, int n) {
     return 0;
 }
+// Pushes buffered writes out; false if any write so far has failed
+bool     Stream::Flush() {
+    return true;
+}
 void     Stream::WriteByte(uint8_t data) {
     WriteBytes(&data, sizeof(data));
 }
@@ -2,9 +2,16 @@
 #define STREAM_H
 
 #include <cstdint>
+#include <string.h>
 
 class Stream {
 public:
+    // Bytes [ReadCursor, ReadEnd) are the next bytes of the stream, already
+    // in memory. Streams that keep such a window (MemoryStream, BufferedStream)
+    // let the primitive reads below skip the virtual ReadBytes call.
+    uint8_t* ReadCursor = NULL;
+    uint8_t* ReadEnd = NULL;
+
     virtual void     Close();
     virtual void     Seek(int64_t offset);
     virtual void     SeekEnd(int64_t offset);
@@ -12,22 +19,28 @@ public:
     virtual size_t   Position();
     virtual size_t   Length();
     virtual size_t   ReadBytes(void* data, int n);
-            uint8_t  ReadByte();
-            uint16_t ReadUInt16();
-            uint16_t ReadUInt16BE();
-            uint32_t ReadUInt32();
-            uint32_t ReadUInt32BE();
-            uint64_t ReadUInt64();
-            int16_t  ReadInt16();
-            int16_t  ReadInt16BE();
-            int32_t  ReadInt32();
-            int32_t  ReadInt32BE();
-            int64_t  ReadInt64();
-            float    ReadFloat();
+    virtual size_t   ReadAt(uint64_t offset, void* data, size_t n);
+            uint8_t  ReadByte() {
+                if (ReadCursor < ReadEnd)
+                    return *ReadCursor++;
+                return ReadValueSlow<uint8_t>();
+            }
+            uint16_t ReadUInt16()   { return ReadValue<uint16_t>(); }
+            uint16_t ReadUInt16BE() { uint16_t data = ReadValue<uint16_t>(); return (uint16_t)(data >> 8 | data << 8); }
+            uint32_t ReadUInt32()   { return ReadValue<uint32_t>(); }
+            uint32_t ReadUInt32BE() { return SwapUInt32(ReadValue<uint32_t>()); }
+            uint64_t ReadUInt64()   { return ReadValue<uint64_t>(); }
+            int16_t  ReadInt16()    { return ReadValue<int16_t>(); }
+            int16_t  ReadInt16BE()  { return (int16_t)ReadUInt16BE(); }
+            int32_t  ReadInt32()    { return ReadValue<int32_t>(); }
+            int32_t  ReadInt32BE()  { return (int32_t)ReadUInt32BE(); }
+            int64_t  ReadInt64()    { return ReadValue<int64_t>(); }
+            float    ReadFloat()    { return ReadValue<float>(); }
             char*    ReadLine();
             char*    ReadString();
             char*    ReadHeaderedString();
     virtual size_t   WriteBytes(void* data, int n);
+    virtual bool     Flush();
             void     WriteByte(uint8_t data);
             void     WriteUInt16(uint16_t data);
             void     WriteUInt16BE(uint16_t data);
@@ -42,6 +55,27 @@ public:
             void     WriteHeaderedString(char* string);
             void     CopyTo(Stream* dest);
     virtual          ~Stream();
+
+    template <typename T> T ReadValue() {
+        if ((size_t)(ReadEnd - ReadCursor) >= sizeof(T)) {
+            T data;
+            memcpy(&data, ReadCursor, sizeof(T));
+            ReadCursor += sizeof(T);
+            return data;
+        }
+        return ReadValueSlow<T>();
+    }
+
+private:
+    template <typename T> T ReadValueSlow() {
+        T data = 0;
+        ReadBytes(&data, sizeof(data));
+        return data;
+    }
+    static uint32_t SwapUInt32(uint32_t data) {
+        return data >> 24 | (data >> 8 & 0xFF00) | (data << 8 & 0xFF0000) | data << 24;
+    }
+    char*    ReadUntil(int terminator, bool includeTerminator);
 };
 
 #endif /* STREAM_H */
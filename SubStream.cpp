@@ -0,0 +1,109 @@
+#include "SubStream.h"
+#include "MemoryStream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The window is clamped to the parent's length. With preload, a range that
+// isn't already in memory is read in with one ReadAt up front.
+SubStream* SubStream::New(Stream* parent, uint64_t offset, size_t size, bool preload) {
+    SubStream* stream = new SubStream;
+    if (!stream) {
+        return NULL;
+    }
+
+    size_t length = parent->Length();
+    if (offset > length)
+        offset = length;
+    if (size > length - offset)
+        size = length - offset;
+
+    stream->parent = parent;
+    stream->offset = offset;
+    stream->size = size;
+    stream->data = NULL;
+    stream->owned = false;
+    stream->position = 0;
+
+    MemoryStream* memory = dynamic_cast<MemoryStream*>(parent);
+    if (memory) {
+        stream->data = memory->data + offset;
+    }
+    else if (preload) {
+        stream->data = (uint8_t*)malloc(size ? size : 1);
+        if (!stream->data)
+            goto FREE;
+
+        stream->owned = true;
+        stream->size = parent->ReadAt(offset, stream->data, size);
+    }
+
+    if (stream->data) {
+        stream->ReadCursor = stream->data;
+        stream->ReadEnd = stream->data + stream->size;
+    }
+    return stream;
+
+    FREE:
+        delete stream;
+        return NULL;
+}
+
+void        SubStream::Close() {
+    if (owned)
+        free(data);
+    data = NULL;
+    ReadCursor = ReadEnd = NULL;
+    Stream::Close();
+}
+void        SubStream::Seek(int64_t offset) {
+    if (offset < 0)
+        offset = 0;
+    if ((uint64_t)offset > size)
+        offset = size;
+
+    if (data)
+        ReadCursor = data + offset;
+    else
+        position = (size_t)offset;
+}
+void        SubStream::SeekEnd(int64_t offset) {
+    Seek((int64_t)size + offset);
+}
+void        SubStream::Skip(int64_t offset) {
+    Seek((int64_t)Position() + offset);
+}
+size_t      SubStream::Position() {
+    return data ? (size_t)(ReadCursor - data) : position;
+}
+size_t      SubStream::Length() {
+    return size;
+}
+
+size_t      SubStream::ReadBytes(void* data, int n) {
+    if (n <= 0)
+        return 0;
+
+    size_t count = ReadAt(Position(), data, (size_t)n);
+    if (this->data)
+        ReadCursor += count;
+    else
+        position += count;
+    return count;
+}
+size_t      SubStream::ReadAt(uint64_t offset, void* data, size_t n) {
+    if (offset >= size)
+        return 0;
+    if (n > size - offset)
+        n = size - offset;
+
+    if (this->data) {
+        memcpy(data, this->data + offset, n);
+        return n;
+    }
+    return parent->ReadAt(this->offset + offset, data, n);
+}
+
+size_t      SubStream::WriteBytes(void* data, int n) {
+    return 0;
+}
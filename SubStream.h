@@ -0,0 +1,32 @@
+#ifndef SUBSTREAM_H
+#define SUBSTREAM_H
+
+#include <stddef.h>
+#include "Stream.h"
+
+// Bounded window [offset, offset + size) of a parent stream, with its own
+// position starting at 0. Reads never go past the window and never touch
+// the parent's cursor (they go through ReadAt), so any number of
+// SubStreams can read one parent from different threads.
+class SubStream : public Stream {
+public:
+    Stream*  parent;
+    uint64_t offset;
+    size_t   size;
+    uint8_t* data;     // the window in memory (parent's memory or a preloaded copy), else NULL
+    bool     owned;
+    size_t   position; // used when data is NULL
+
+    static SubStream* New(Stream* parent, uint64_t offset, size_t size, bool preload);
+    void        Close();
+    void        Seek(int64_t offset);
+    void        SeekEnd(int64_t offset);
+    void        Skip(int64_t offset);
+    size_t      Position();
+    size_t      Length();
+    size_t      ReadBytes(void* data, int n);
+    size_t      ReadAt(uint64_t offset, void* data, size_t n);
+    size_t      WriteBytes(void* data, int n);
+};
+
+#endif /* SUBSTREAM_H */
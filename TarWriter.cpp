@@ -0,0 +1,128 @@
+#include "TarWriter.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TAR_BLOCK_SIZE 512
+
+struct tar_header_t {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+TarWriter* TarWriter::New(Stream* output, int64_t modifiedTime) {
+    if (!output)
+        return NULL;
+
+    TarWriter* writer = new TarWriter;
+    if (!writer) {
+        return NULL;
+    }
+
+    writer->Output = output;
+    writer->ModifiedTime = modifiedTime < 0 ? 0 : modifiedTime;
+    return writer;
+}
+
+// Octal numbers fill the field minus its terminating NUL
+static void PutOctal(char* field, size_t width, uint64_t value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%0*llo", (int)(width - 1), (unsigned long long)value);
+    memcpy(field, buffer, width - 1);
+    field[width - 1] = 0;
+}
+
+bool TarWriter::WriteHeader(const char* filename, size_t size, char type) {
+    tar_header_t header;
+    memset(&header, 0, sizeof(header));
+
+    // Split long paths into prefix/name at a slash where both halves fit
+    size_t length = strlen(filename);
+    if (length <= sizeof(header.name)) {
+        memcpy(header.name, filename, length);
+    }
+    else {
+        const char* split = NULL;
+        for (const char* slash = strchr(filename, '/'); slash; slash = strchr(slash + 1, '/')) {
+            if ((size_t)(slash - filename) > sizeof(header.prefix))
+                break;
+            if (length - (slash - filename) - 1 <= sizeof(header.name)) {
+                split = slash;
+                break;
+            }
+        }
+
+        if (split) {
+            memcpy(header.prefix, filename, split - filename);
+            memcpy(header.name, split + 1, length - (split - filename) - 1);
+        }
+        else {
+            // GNU long name: the full name goes in its own record first
+            if (!WriteHeader("././@LongLink", length + 1, 'L') || !WriteData((const uint8_t*)filename, length + 1))
+                return false;
+            memcpy(header.name, filename, sizeof(header.name));
+        }
+    }
+
+    PutOctal(header.mode, sizeof(header.mode), 0644);
+    PutOctal(header.uid, sizeof(header.uid), 0);
+    PutOctal(header.gid, sizeof(header.gid), 0);
+    PutOctal(header.size, sizeof(header.size), size);
+    PutOctal(header.mtime, sizeof(header.mtime), ModifiedTime);
+    header.type = type;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    // The checksum is taken with its own field filled with spaces
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    uint32_t checksum = 0;
+    for (size_t i = 0; i < sizeof(header); i++)
+        checksum += ((uint8_t*)&header)[i];
+    PutOctal(header.checksum, 7, checksum);
+    header.checksum[7] = ' ';
+
+    return Output->WriteBytes(&header, sizeof(header)) == sizeof(header);
+}
+bool TarWriter::WriteData(const uint8_t* data, size_t size) {
+    static uint8_t zeroes[TAR_BLOCK_SIZE];
+
+    if (size && Output->WriteBytes((void*)data, (int)size) != size)
+        return false;
+
+    size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    if (padding && Output->WriteBytes(zeroes, (int)padding) != padding)
+        return false;
+
+    return true;
+}
+
+bool TarWriter::Add(const char* filename, const uint8_t* data, size_t size) {
+    return WriteHeader(filename, size, '0') && WriteData(data, size);
+}
+// Returns false if the archive couldn't be finished
+bool TarWriter::Close() {
+    // End of archive: two empty blocks
+    uint8_t zeroes[TAR_BLOCK_SIZE * 2];
+    memset(zeroes, 0, sizeof(zeroes));
+    bool written = Output->WriteBytes(zeroes, sizeof(zeroes)) == sizeof(zeroes);
+    written = Output->Flush() && written;
+
+    Output->Close();
+    delete this;
+    return written;
+}
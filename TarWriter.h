@@ -0,0 +1,24 @@
+#ifndef TARWRITER_H
+#define TARWRITER_H
+
+#include <stdint.h>
+#include "Stream.h"
+
+// Writes files into a POSIX ustar archive, one after another, on any
+// writable stream (a file or stdout). Names too long for the header are
+// stored in a GNU long-name record.
+class TarWriter {
+public:
+    Stream*  Output;
+    int64_t  ModifiedTime;
+
+    static TarWriter* New(Stream* output, int64_t modifiedTime);
+    bool              Add(const char* filename, const uint8_t* data, size_t size);
+    bool              Close();
+
+private:
+    bool              WriteHeader(const char* filename, size_t size, char type);
+    bool              WriteData(const uint8_t* data, size_t size);
+};
+
+#endif /* TARWRITER_H */
@@ -0,0 +1,131 @@
+#include "ThreadPool.h"
+
+thread_local int ThreadPool::WorkerIndex = -1;
+
+ThreadPool* ThreadPool::New(int threadCount) {
+    if (threadCount < 1)
+        threadCount = 1;
+
+    ThreadPool* pool = new ThreadPool;
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->ThreadCount = threadCount;
+    pool->Workers = new Worker[threadCount];
+    pool->Queued = 0;
+    pool->Pending = 0;
+    pool->NextWorker = 0;
+    pool->Stopping = false;
+
+    for (int i = 0; i < threadCount; i++) {
+        pool->Threads.push_back(std::thread(&ThreadPool::Run, pool, i));
+    }
+
+    return pool;
+}
+int  ThreadPool::HardwareThreads() {
+    int count = (int)std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+// Runs task(0) to task(count - 1) on up to threadCount short-lived threads,
+// the caller being one of them. Unlike Submit/Wait it is safe to call from
+// inside a pool task.
+void ThreadPool::ParallelFor(int threadCount, size_t count, const std::function<void(size_t)>& task) {
+    std::atomic<size_t> next(0);
+    auto run = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            task(i);
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threadCount && (size_t)t < count; t++)
+        workers.push_back(std::thread(run));
+    run();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    // Tasks spawned from a worker stay local to it, others are dealt round-robin
+    int index = WorkerIndex;
+    if (index < 0)
+        index = NextWorker.fetch_add(1) % ThreadCount;
+
+    Pending++;
+    {
+        std::lock_guard<std::mutex> guard(Workers[index].lock);
+        Workers[index].tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(SleepLock);
+        Queued++;
+    }
+    WorkCond.notify_one();
+}
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> guard(SleepLock);
+    IdleCond.wait(guard, [this] { return Pending == 0; });
+}
+void ThreadPool::Close() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> guard(SleepLock);
+        Stopping = true;
+    }
+    WorkCond.notify_all();
+
+    for (size_t i = 0; i < Threads.size(); i++) {
+        Threads[i].join();
+    }
+
+    delete[] Workers;
+    delete this;
+}
+
+bool ThreadPool::Take(int index, std::function<void()>* task) {
+    {
+        std::lock_guard<std::mutex> guard(Workers[index].lock);
+        if (!Workers[index].tasks.empty()) {
+            *task = std::move(Workers[index].tasks.front());
+            Workers[index].tasks.pop_front();
+            Queued--;
+            return true;
+        }
+    }
+
+    for (int i = 1; i < ThreadCount; i++) {
+        Worker* victim = &Workers[(index + i) % ThreadCount];
+
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (!victim->tasks.empty()) {
+            *task = std::move(victim->tasks.back());
+            victim->tasks.pop_back();
+            Queued--;
+            return true;
+        }
+    }
+    return false;
+}
+void ThreadPool::Run(int index) {
+    WorkerIndex = index;
+
+    std::function<void()> task;
+    for (;;) {
+        if (Take(index, &task)) {
+            task();
+            task = nullptr;
+
+            if (--Pending == 0) {
+                std::lock_guard<std::mutex> guard(SleepLock);
+                IdleCond.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(SleepLock);
+        WorkCond.wait(guard, [this] { return Stopping || Queued > 0; });
+        if (Stopping && Queued == 0)
+            break;
+    }
+}
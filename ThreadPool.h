@@ -0,0 +1,49 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: each worker owns a deque and runs its own tasks in
+// submission order from the front; when empty it steals from the back of the
+// other workers' deques. Submitting in file order keeps each worker's reads
+// moving forward.
+class ThreadPool {
+public:
+    struct Worker {
+        std::mutex                        lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    int                      ThreadCount;
+    Worker*                  Workers;
+    std::vector<std::thread> Threads;
+    std::atomic<int>         Queued;
+    std::atomic<int>         Pending;
+    std::atomic<int>         NextWorker;
+    std::mutex               SleepLock;
+    std::condition_variable  WorkCond;
+    std::condition_variable  IdleCond;
+    bool                     Stopping;
+
+    // Index of the calling worker thread, or -1 outside of any pool
+    static thread_local int  WorkerIndex;
+
+    static ThreadPool* New(int threadCount);
+    static int         HardwareThreads();
+    static void        ParallelFor(int threadCount, size_t count, const std::function<void(size_t)>& task);
+    void               Submit(std::function<void()> task);
+    void               Wait();
+    void               Close();
+
+private:
+    bool               Take(int index, std::function<void()>* task);
+    void               Run(int index);
+};
+
+#endif /* THREADPOOL_H */